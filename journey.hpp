@@ -5,7 +5,27 @@
 // - [x] Journaling support: data can be rolled back to an earlier state to retrieve older versions of files.
 // - [x] Append-only format: create or update new entries just by appending stuff to the journal file.
 // - [x] Compaction support: all duplicated names are removed. the one with the largest timestamp is kept.
-// - [x] Always aligned: data is always aligned for safe memory accesses.
+// - [x] Online compaction: journals can be compacted in place while other writers keep appending.
+// - [x] Auto compaction: space amplification is tracked, and can trigger throttled background compactions.
+// - [x] Retention policies: compaction can keep the last N versions, daily/weekly versions, or drop old ones.
+// - [x] Compaction plans: dry runs report reclaimable bytes, output size and duration from the index alone.
+// - [x] Merge support: many journals can be merged into one, keeping the newest version of every name.
+// - [x] Tombstones: names (or whole prefixes) can be deleted, and compactions drop what they delete.
+// - [x] Links: renames, copies and hard links share existing data, without copying it.
+// - [x] Sealed journals: compaction can sort entries and append a footer index, read without loading.
+// - [x] Aligned: data blocks are 8-byte aligned for safe memory accesses (but for format 3 entries and pack records).
+// - [x] Tiny entries: optional varint trailers of a few bytes, instead of 40-byte info blocks.
+// - [x] Packs: many small files can be appended as a single entry, listed by load() from its table alone.
+// - [x] Page aligned: optional 4 KiB aligned data blocks, O_DIRECT friendly.
+// - [x] Huge aligned: data blocks can be aligned per entry, up to 2 MiB, and compaction keeps or raises it.
+// - [x] Segmented: optional size-based rollover to `name.000N.joy` segments, preallocated ahead of appends.
+// - [x] Deduplication: optional content hashing, so re-appending unchanged data is a no-op.
+// - [x] Chunking: optional content-defined chunks, so large files that barely change are stored once.
+// - [x] Compression: optional built-in LZ codec, skipped for incompressible data, with trained dictionaries.
+// - [x] Delta encoding: optional binary deltas against the previous version, in bounded chains.
+// - [x] Checksums: optional CRC32C per entry (SSE 4.2 accelerated), verified never, once or always.
+// - [x] Encryption: optional per-entry authenticated encryption (XChaCha20-Poly1305) of data, and names.
+// - [x] Crash tolerant: torn tails are skipped by load(), which resynchronizes on the last good entry.
 // - [x] Concat friendly: glue journals together and the result will still be a valid journey file.
 // - [x] Foreign support: append data to a foreign file and result will still be a valid journey file.
 // - [x] Simple, tiny, portable, cross-platform, header-only.
@@ -36,175 +56,3251 @@
 //      [ 64-bit file block length ]
 //      [ 64-bit magic             ]
 // }
+// Format 3 entries are unpadded `[name][data][trailer]` triplets instead, whose trailer is `[varint stamp]
+// [varint name length][varint data length][tags][8-bit trailer length]['joy3']`. Both formats mix freely.
+// Info blocks are stored in the byte order of the host that wrote them, which readers tell apart by the
+// magic and swap as needed. Everything else (tags, indexes) is little-endian.
+// Entries with an empty name are fillers (ie, alignment padding) and are skipped by readers. A filler may
+// start with a tag block (`[varint size][varint tag][varint len][value]...`) describing the entry right after it.
+// Readers older than 2.1.0 do not skip fillers, but list each of them as an entry named `''`, whose data is
+// the filler's raw bytes (tag block included). They also ignore tags, so they read entries back as stored:
+// compressed, chunked, delta and encrypted entries return their packed bytes, chunk list, patch or ciphertext
+// instead of their content. Only untagged (or merely hashed, checksummed or aligned) entries read back fine.
+// Tombstones are empty entries tagged as such (older readers see them as empty files).
+// Links hold the name of the entry they share the data of, tagged with the distance back to it.
+// Encrypted entries are tagged with their 192-bit nonce (`[64 bits][128 bits]`, the latter being what hchacha20
+// derives the xchacha20 subkey from), and their data block ends with a 16-byte tag (names, when encrypted too,
+// are stored as the hex of their ciphertext and tag).
+// Names starting with `\0` are reserved for internal entries, like the segment list of a segmented journal,
+// compression dictionaries (`\0dictionary:<id>`), shared chunks (`\0chunk:<id>`), packs of small files
+// (`\0pack`: a `[varint size][name][stamp][size]...` table, then the data of each record) or the footer index of a
+// sealed journal (sorted `[name][offset][size][stamp][hash]...` records plus a bloom filter).
 
 #pragma once
 #include <stdint.h>
 #include <ctime>
+#include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
-#define JOURNEY_VERSION "2.0.1" /* (2015/12/08) Fix compilation warnings (un/signed warnings)
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define JOURNEY_POSIX 1
+#endif
+
+#if defined(__linux__) && defined(__GLIBC__) && ( __GLIBC__ > 2 || ( __GLIBC__ == 2 && __GLIBC_MINOR__ >= 25 ) )
+#include <sys/random.h>
+#define JOURNEY_GETRANDOM 1
+#endif
+
+#if defined(__x86_64__) && ( defined(__GNUC__) || defined(__clang__) )
+#include <nmmintrin.h>
+#define JOURNEY_SSE42 1
+#endif
+
+#define JOURNEY_VERSION "2.25.0" /* (2026/10/16) Torn tail recovery
+#define JOURNEY_VERSION "2.24.0" // (2026/10/16) Per-entry authenticated encryption
+#define JOURNEY_VERSION "2.23.0" // (2026/10/16) Per-entry data block alignment up to 2 MiB
+#define JOURNEY_VERSION "2.22.0" // (2026/10/16) Link entries sharing existing data
+#define JOURNEY_VERSION "2.21.0" // (2026/10/16) Tombstones and prefix tombstones
+#define JOURNEY_VERSION "2.20.0" // (2026/10/16) Packs of small files
+#define JOURNEY_VERSION "2.19.0" // (2026/10/16) Format 3 entries with varint trailers
+#define JOURNEY_VERSION "2.18.0" // (2026/10/16) Byte-swapped loading of foreign-endian journals
+#define JOURNEY_VERSION "2.17.0" // (2026/10/16) CRC32C checksums; verify on read
+#define JOURNEY_VERSION "2.16.0" // (2026/10/16) Binary delta entries
+#define JOURNEY_VERSION "2.15.0" // (2026/10/16) Content-defined chunking
+#define JOURNEY_VERSION "2.14.0" // (2026/10/16) Trained compression dictionaries
+#define JOURNEY_VERSION "2.13.0" // (2026/10/16) Built-in LZ compression
+#define JOURNEY_VERSION "2.12.0" // (2026/10/16) Compaction plans (dry runs)
+#define JOURNEY_VERSION "2.11.0" // (2026/10/16) Space amplification tracking; background auto-compaction
+#define JOURNEY_VERSION "2.10.0" // (2026/10/16) Sealed journals with footer index
+#define JOURNEY_VERSION "2.9.0" // (2026/10/16) Locality ordered compaction layouts; access traces
+#define JOURNEY_VERSION "2.8.0" // (2026/10/16) K-way merge of journals
+#define JOURNEY_VERSION "2.7.0" // (2026/10/16) Retention policies for compaction
+#define JOURNEY_VERSION "2.6.0" // (2026/10/16) Online, in-place compaction; locked appends
+#define JOURNEY_VERSION "2.5.0" // (2026/10/16) Parallel compaction
+#define JOURNEY_VERSION "2.4.0" // (2026/10/16) Streamed, bounded-memory compaction
+#define JOURNEY_VERSION "2.3.0" // (2026/10/16) Content hashes; deduplicated appends
+#define JOURNEY_VERSION "2.2.0" // (2026/10/16) Preallocated appends; segmented journals
+#define JOURNEY_VERSION "2.1.0" // (2026/10/16) Page aligned entries; O_DIRECT reads and appends
+#define JOURNEY_VERSION "2.0.1" // (2015/12/08) Fix compilation warnings (un/signed warnings)
 #define JOURNEY_VERSION "2.0.0" // (2015/12/07) More compact file format; fixes
 #define JOURNEY_VERSION "1.0.0" // (2015/12/05) Initial commit */
 
-class journey {
-public:
+class journey {
+public:
+
+    struct entry {
+        uint64_t offset;
+        uint64_t size;
+        uint64_t stamp;
+        uint64_t hash; // hash64() of the content with its lowest bit set, if recorded (0 otherwise)
+        uint64_t begin, end; // whole entry, tags and info block included
+        uint64_t raw; // decoded size of a compressed entry (0 if stored as is)
+        uint64_t dict; // id of the dictionary it was compressed against (0 if none)
+        uint64_t chunked; // decoded size of a chunked entry, whose data lists its chunks (0 otherwise)
+        uint64_t delta; // 1 + distance back from 'begin' to the end of the version a delta entry patches (0 if none)
+        uint64_t patched; // decoded size of a delta entry, once patched (0 otherwise)
+        uint64_t crc; // crc32c() of the stored data block with bit 32 set, if recorded (0 otherwise)
+        uint64_t packed; // 1 for the records of a pack (see append_pack()), whose begin and end are the pack's
+        uint64_t tombstone; // 1 if the entry deletes its name, 2 if it deletes every name it prefixes (0 otherwise)
+        uint64_t link; // 1 + distance back from 'begin' to the end of the entry a link shares the data of (0 if none)
+        uint64_t align; // alignment its data block was appended (or compacted) with, if larger than 8 bytes (0 otherwise)
+        uint64_t sealed; // nonce of an encrypted entry (its last 64 bits), with bit 0 set if its name is encrypted too (0 if not encrypted)
+        uint64_t salt[2]; // the first 128 bits of the 192-bit nonce of an encrypted entry
+    };
+
+    // data block alignment, in bytes (a power of two, from 8 up to 2 MiB), which can change from one
+    // append to the next. when larger than 8, a filler entry is laid out in front of each appended
+    // entry so its data block lands on the requested boundary, and tags it with the alignment. compact()
+    // keeps the alignment of every entry, or raises it to its own 'align' (re-aligning the journal).
+    uint64_t align = 8;
+
+    // bypass the page cache on read() and append(). entries are written page aligned and padded to
+    // whole pages, through aligned bounce buffers (O_DIRECT). falls back to buffered i/o when the
+    // platform or filesystem does not support it.
+    bool direct_io = false;
+
+    // preallocate space ahead of appends, in extents of this many bytes (0 = off), so long-lived
+    // journals do not fragment. space reserved past the end of file is trimmed by trim(), which is
+    // also called when the object goes out of scope.
+    uint64_t prealloc = 0;
+
+    // roll over to a new 'name.000N.joy' segment once the current one would grow past this many
+    // bytes (0 = off). the journal file then becomes a tiny manifest listing its segments, and both
+    // load() and read() see the whole segment set as one logical journal. plain journals that
+    // already exist are never converted.
+    uint64_t segment_size = 0;
+
+    // record a content hash for every appended entry, and turn appends whose content matches the
+    // latest loaded version of the same name into no-ops. compares against the toc, so load() first.
+    bool dedupe = false;
+
+    // compress appended entries with the built-in lz codec, when a quick sample of the content says
+    // it pays off. compressed entries are tagged, and read() decodes them transparently.
+    bool compress = false;
+
+    // split appended entries into content-defined chunks of about this many bytes (a power of two; 0 =
+    // off), once they are at least 4 times that large. every distinct chunk is stored once, as a reserved
+    // entry, and the entry itself just lists its chunks. read() reassembles them transparently.
+    uint64_t chunking = 0;
+
+    // store appended entries as binary deltas against the latest loaded version of the same name, when
+    // that saves 1/8 of the content at least, chaining up to this many deltas in front of a full version
+    // (0 = off). read() patches them transparently, and compact() rebases them to full versions. plain
+    // journals only: segmented ones append full versions.
+    unsigned delta_chain = 0;
+
+    // format of appended entries: 2 (the default: 40-byte info blocks, 8-byte aligned blocks) or 3 (an
+    // unpadded varint trailer of a few bytes, for journals of tiny entries). both formats mix freely in a
+    // journal. appends that need aligned data (align > 8, direct_io) and internal entries stay in format
+    // 2. compact() converts the entries it keeps to format 3 when it is set.
+    int format = 2;
+
+    // size of the dictionaries built by train() and by retraining compactions (up to 32 KiB)
+    uint64_t dictionary_size = 16 << 10;
+
+    // make compact() train a new dictionary out of the entries it keeps, and re-encode the small ones
+    // against it, in the same pass. re-encoded entries are staged in memory, up to 256 MiB.
+    bool retrain = false;
+
+    // worker threads used by compact()
+    unsigned threads = 1;
+
+    // order of the entries written by compact(): as found in the journal (the default, which copies
+    // the most adjacent entries as single extents), by path (so directories stay together), by stamp,
+    // or by first access as recorded in 'trace'. versions of a name always keep their relative order.
+    enum { by_journal, by_path, by_stamp, by_trace };
+    int order = by_journal;
+
+    // make compact() write sealed journals: entries sorted by name, followed by a footer index (a
+    // sorted offset table and a bloom filter), so load_index() can serve read() without any load().
+    // sealed journals are still regular journals. seal into new files, as the index only covers the
+    // entries written by that compaction (encrypted ones aside: no index is written if they are all).
+    bool seal = false;
+
+    // compact in the background once space_amplification() reaches this ratio (0 = off), as checked
+    // after every append(). when set, 'compaction_policy' decides instead. the compacted journal is
+    // swapped in by the next load() (or on destruction), so the toc never points into a stale file.
+    // plain journals on posix only.
+    double auto_compact = 0;
+    std::function<bool( const journey & )> compaction_policy;
+
+    // throughput cap for compaction, in bytes per second (0 = unthrottled), so that background
+    // compactions do not starve foreground i/o
+    uint64_t compaction_rate = 0;
+
+    // record a crc32c() of the data block of every appended entry (as stored: packed, patched...), and
+    // check it on read(): never, the first time an entry is read since load(), or on every read. entries
+    // moved by compact() keep theirs, re-encoded ones get a new one, and delta entries rebased to full
+    // versions lose it. entries without one are never checked. footer indexes keep them too.
+    bool checksum = false;
+    enum { verify_never, verify_first, verify_always };
+    int verify = verify_never;
+
+    // encrypt appended entries with this 256-bit key (32 bytes; empty = off), through xchacha20-poly1305:
+    // every data block gets a random 192-bit nonce (out of the os csprng, so that a key can be shared by
+    // many writers for billions of entries) and a 16-byte tag, and read() fails on data that does not
+    // authenticate, or without the key. with 'encrypt_names', names are encrypted too (and stored as hex),
+    // so load() needs the key to list them. compact() moves encrypted entries as they are, and encrypts
+    // the ones it re-encodes anew (it needs the key for chunked and delta entries). content hashes
+    // (dedupe, chunks) are keyed, links become copies, and footer indexes leave encrypted entries out.
+    std::string key;
+    bool encrypt_names = false;
+
+    // when enabled, read() records every name it is asked for into 'trace' (not thread-safe)
+    bool tracing = false;
+    mutable std::vector<std::string> trace;
+
+    journey()
+    {}
+
+    ~journey() {
+        settle();
+        if( prealloc ) {
+            trim();
+        }
+    }
+
+    journey( const std::string &file ) {
+        init( file );
+    }
+
+    bool init( const std::string &file ) {
+        settle();
+        *this = journey();
+        return file.empty() ? false : (journal = file, true);
+    }
+
+    bool load( uint64_t beg_stamp = 0, uint64_t end_stamp = std::time(0), std::ostream *debugstream = 0 ) {
+        settle();
+        toc.clear();
+        files.clear();
+        bases.clear();
+        appended.clear();
+        parts.clear();
+        dict_cache.clear();
+        verified.clear();
+        erased.clear();
+        erased_prefixes.clear();
+        hashed.clear();
+        active = 0;
+        bytes_live = bytes_total = torn_bytes = 0;
+        loaded_range[0] = beg_stamp, loaded_range[1] = end_stamp;
+        if( beg_stamp > end_stamp ) {
+            return false;
+        }
+        resolve( files, bases );
+        bool ok = true;
+        unsigned count = 0;
+        for( size_t i = files.size(); i-- > 0; ) {
+            ok = load_file( files[i], bases[i], beg_stamp, end_stamp, debugstream, count, ~0ull, i + 1 == files.size() ? &torn_bytes : 0 ) && ok;
+            bytes_total += file_size( files[i] );
+        }
+        if( debugstream ) {
+            *debugstream << "---" << std::endl;
+        }
+        return ok && count > 0;
+    }
+
+    // maps the footer index of a sealed journal. read() then looks names up in it (bloom filter, then
+    // binary search) when they are not in the toc, so no load() is needed.
+    bool load_index() {
+        std::string name;
+        uint64_t datapos = 0, datalen = 0;
+        footer.reset();
+        if( !tail_entry( journal, name, datapos, datalen ) || name != reserved( "index" ) || datalen < 8*3 ) {
+            return false;
+        }
+#ifdef JOURNEY_POSIX
+        int fd = ::open( journal.c_str(), O_RDONLY );
+        uint64_t at = datapos - datapos % page, len = datapos + datalen - at;
+        void *map = fd < 0 ? MAP_FAILED : mmap( 0, len, PROT_READ, MAP_SHARED, fd, at );
+        if( fd >= 0 ) close( fd );
+        if( map == MAP_FAILED ) {
+            return false;
+        }
+        footer = std::shared_ptr<const char>( (const char *)map + ( datapos - at ), [map, len]( const char * ) { munmap( map, len ); } );
+#else
+        char *buf = new char[ datalen ];
+        footer = std::shared_ptr<const char>( buf, std::default_delete<char[]>() );
+        if( !std::ifstream( journal.c_str(), std::ios::binary ).seekg( datapos ).read( buf, datalen ) ) {
+            return footer.reset(), false;
+        }
+#endif
+        const char *p = footer.get();
+        uint64_t count = get64( p ), bloom = get64( p + 8 );
+        footer_size = datalen;
+        if( count > datalen / ( 8*10 ) || !bloom || bloom > datalen - 8*3 - count * 8*10 || !get64( p + 16 ) ) {
+            return footer.reset(), false;
+        }
+        return true;
+    }
+
+    std::map<std::string, entry> get_toc() const {
+        return toc;
+    }
+
+    // bytes in the journal per byte of live entries, as tracked by load() and append(). entries outside
+    // the loaded stamp range, older versions, fillers and foreign data all count as dead.
+    double space_amplification() const {
+        return bytes_live ? double( bytes_total ) / bytes_live : 1.0;
+    }
+
+    template<typename T>
+    bool read( T &data, const std::string &name ) const {
+        if( tracing ) {
+            trace.push_back( name );
+        }
+        entry entry;
+        if( find( name, entry ) ) {
+            data.resize( content_size( entry ) );
+            if( read_entry( entry, name, &data[0] ) ) {
+                return true;
+            }
+        }
+        return (data = T(), false);
+    }
+
+    std::string read( const std::string &name ) const {
+        std::string data;
+        return read( data, name ) ? data : std::string();
+    }
+
+    bool append( const std::string &filename, const void *ptr, size_t len, uint64_t stamp = std::time(0) ) const {
+        if( journal.size() && ptr && !filename.empty() && filename[0] ) {
+            std::string tags;
+            if( dedupe ) {
+                uint64_t hash = content_hash( ptr, len );
+                auto found = toc.find( filename );
+                if( found != toc.end() && found->second.hash == hash && content_size( found->second ) == len ) {
+                    return true;
+                }
+                // content already stored under another name is linked instead
+                auto same = hashed.find( hash );
+                auto other = same == hashed.end() ? toc.end() : toc.find( same->second );
+                if( key.empty() && other != toc.end() && other->second.hash == hash && content_size( other->second ) == len && same->second != filename
+                    && ( files.empty() || files == std::vector<std::string>( 1, journal ) ) ) {
+                    return link( filename, same->second, stamp );
+                }
+                put_tag( tags, tag_hash, hash );
+            }
+            if( chunking && len >= chunking * 4 ) {
+                std::string manifest;
+                const char *data = (const char *)ptr;
+                uint64_t at = 0;
+                for( uint64_t end : cut( data, len, chunking ) ) {
+                    std::string chunk_tags;
+                    uint64_t id = content_hash( data + at, end - at );
+                    std::string name = chunk_name( id );
+                    put_tag( chunk_tags, tag_hash, id );
+                    if( !parts.count( name ) && !appended.count( name ) && !append_entry( name, data + at, end - at, stamp, chunk_tags, true ) ) {
+                        return false;
+                    }
+                    put64( manifest, id );
+                    put64( manifest, end - at );
+                    at = end;
+                }
+                put_tag( tags, tag_chunked, len );
+                if( !append_entry( filename, manifest.data(), manifest.size(), stamp, tags, false ) ) {
+                    return false;
+                }
+            } else {
+                auto loaded = toc.find( filename );
+                std::string base, patch;
+                if( delta_chain && ( files.empty() || files == std::vector<std::string>( 1, journal ) ) && loaded != toc.end() && chain_of( loaded->second ) < delta_chain ) {
+                    base.resize( content_size( loaded->second ) );
+                    if( read_entry( loaded->second, filename, &base[0] ) ) {
+                        patch = make_delta( base, (const char *)ptr, len );
+                    }
+                }
+                bool delta = !patch.empty() && patch.size() <= len - len / 8;
+                if( delta ) {
+                    put_tag( tags, tag_patched, len );
+                }
+                if( !( delta ? append_entry( filename, patch.data(), patch.size(), stamp, tags, true, loaded->second.end )
+                             : append_entry( filename, (const char *)ptr, len, stamp, tags, true ) ) ) {
+                    return false;
+                }
+            }
+#ifdef JOURNEY_POSIX
+            maybe_compact();
+#endif
+            return true;
+        }
+        return false;
+    }
+
+    // appends many small files at once, as the records of a single pack entry: one info block (and one
+    // step of the load() scan) for all of them. load() lists records as regular entries, from the table
+    // of the pack alone, and read() slices them out of it. records are stored as is: no dedupe,
+    // compression or deltas. compact() re-packs the live records of every pack. encrypted journals
+    // (see 'key') append the files one by one instead.
+    bool append_pack( const std::vector< std::pair<std::string, std::string> > &files, uint64_t stamp = std::time(0) ) const {
+        if( !key.empty() ) {
+            for( auto &f : files ) {
+                if( !append( f.first, f.second.data(), f.second.size(), stamp ) ) {
+                    return false;
+                }
+            }
+            return !files.empty();
+        }
+        std::string table, data, pack, tags;
+        for( auto &f : files ) {
+            if( f.first.empty() || !f.first[0] ) {
+                return false;
+            }
+            put_varint( table, f.first.size() );
+            table += f.first;
+            put_varint( table, stamp );
+            put_varint( table, f.second.size() );
+            data += f.second;
+        }
+        put_varint( pack, table.size() );
+        pack += table + data;
+        if( checksum ) {
+            put_tag( tags, tag_crc, crc32c( pack.data(), pack.size() ) | 1ull << 32 );
+        }
+        if( align > 8 ) {
+            put_tag( tags, tag_align, align );
+        }
+        std::string file = journal.empty() || files.empty() ? std::string() : target( pack.size() + tags.size() );
+        uint64_t written = 0;
+        if( file.empty() || !append_file( file, reserved( "pack" ), pack.data(), pack.size(), stamp, true, tags, &written ) ) {
+            return false;
+        }
+        bytes_total += written;
+        for( auto &f : files ) {
+            auto found = appended.find( f.first );
+            auto loaded = toc.find( f.first );
+            uint64_t dead = found != appended.end() ? found->second : loaded == toc.end() ? 0 : loaded->second.packed ? loaded->second.size : loaded->second.end - loaded->second.begin;
+            appended[ f.first ] = f.second.size();
+            bytes_live += f.second.size() - dead;
+        }
+#ifdef JOURNEY_POSIX
+        maybe_compact();
+#endif
+        return true;
+    }
+
+    // records the deletion of a file. load() then hides the versions of it written before (as long as the
+    // tombstone is within the loaded stamp range) and compactions drop them. erase_prefix() deletes every
+    // name starting with 'prefix' alike. both drop the deleted names from the toc right away.
+    bool erase( const std::string &filename, uint64_t stamp = std::time(0) ) {
+        if( !tombstone( filename, 1, stamp ) ) {
+            return false;
+        }
+        toc.erase( filename );
+        return true;
+    }
+
+    bool erase_prefix( const std::string &prefix, uint64_t stamp = std::time(0) ) {
+        if( !tombstone( prefix, 2, stamp ) ) {
+            return false;
+        }
+        for( auto it = toc.lower_bound( prefix ); it != toc.end() && !it->first.compare( 0, prefix.size(), prefix ); ) {
+            it = toc.erase( it );
+        }
+        return true;
+    }
+
+    // makes 'filename' share the data of the loaded version of 'existing' (a rename, copy or hard link),
+    // through a link entry that only holds the name it points at. load() resolves links to the data they
+    // share, and compactions keep the sharing when both names survive (or write a copy otherwise).
+    // segmented and encrypted journals (and encrypted entries) get a copy right away.
+    bool link( const std::string &filename, const std::string &existing, uint64_t stamp = std::time(0) ) const {
+        auto found = toc.find( existing );
+        if( journal.empty() || filename.empty() || !filename[0] || found == toc.end() ) {
+            return false;
+        }
+        if( !key.empty() || found->second.sealed || ( !files.empty() && files != std::vector<std::string>( 1, journal ) ) ) {
+            std::string data = read( existing );
+            return data.size() == content_size( found->second ) && append( filename, data.data(), data.size(), stamp );
+        }
+        // pack records are linked through their pack (whose extent they carry), links through the link
+        return append_entry( filename, existing.data(), existing.size(), stamp, std::string(), false, found->second.end );
+    }
+
+    // trains a dictionary over a sample of the loaded entries (the small ones), appends it to the journal
+    // and packs later compressed appends against it. load() first.
+    bool train() {
+        selection live;
+        for( auto &it : toc ) {
+            live.push_back( std::make_pair( &it.first, it.second ) );
+        }
+        std::map<uint64_t, std::string> cache;
+        std::string dict = train_dictionary( samples_of( live, files, bases, parts, cache ), dictionary_limit() ), tags;
+        std::string stored = dict;
+        uint64_t id = hash64( dict.data(), dict.size() ) | 1, salt[2], nonce = key.empty() ? 0 : nonce_of( false, salt ), stamp = std::time(0);
+        put_tag( tags, tag_hash, id );
+        if( nonce ) {
+            seal_data( stored, nonce, salt, dict_name( id ), stamp );
+            put_nonce( tags, nonce, salt );
+        }
+        std::string file = dict.empty() ? std::string() : target( stored.size() + 64 );
+        if( file.empty() || !append_file( file, dict_name( id ), stored.data(), stored.size(), stamp, false, tags ) ) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock( cache_mutex );
+            dict_cache[ id ] = dict;
+        }
+        active = id;
+        return true;
+    }
+
+#ifdef JOURNEY_SSE42
+    __attribute__(( target( "sse4.2" ) )) static uint32_t crc32c_sse42( uint32_t crc, const unsigned char *p, size_t len ) {
+        uint64_t c = crc, v;
+        for( ; len >= 8; p += 8, len -= 8 ) {
+            memcpy( &v, p, 8 );
+            c = _mm_crc32_u64( c, v );
+        }
+        for( ; len; --len ) c = _mm_crc32_u8( uint32_t( c ), *p++ );
+        return uint32_t( c );
+    }
+#endif
+
+    // CRC32C (castagnoli), through the sse4.2 crc32 instruction when the cpu has it, else slicing by 8
+    static uint32_t crc32c( const void *ptr, size_t len, uint32_t crc = 0 ) {
+        static const std::vector<uint32_t> table = [] {
+            std::vector<uint32_t> t( 8 * 256 );
+            for( uint32_t i = 0; i < 256; ++i ) {
+                uint32_t c = i;
+                for( int k = 0; k < 8; ++k ) c = c & 1 ? ( c >> 1 ) ^ 0x82F63B78 : c >> 1;
+                t[i] = c;
+            }
+            for( uint32_t i = 0; i < 256 * 7; ++i ) t[i + 256] = ( t[i] >> 8 ) ^ t[ t[i] & 0xff ];
+            return t;
+        }();
+        const unsigned char *p = (const unsigned char *)ptr;
+        crc = ~crc;
+#ifdef JOURNEY_SSE42
+        static const bool sse42 = __builtin_cpu_supports( "sse4.2" );
+        if( sse42 ) {
+            return ~crc32c_sse42( crc, p, len );
+        }
+#endif
+        for( ; len >= 8; p += 8, len -= 8 ) {
+            uint64_t v = get64( p ) ^ crc;
+            crc = table[ 7 * 256 + ( v & 0xff ) ] ^ table[ 6 * 256 + ( v >> 8 & 0xff ) ] ^ table[ 5 * 256 + ( v >> 16 & 0xff ) ] ^
+                  table[ 4 * 256 + ( v >> 24 & 0xff ) ] ^ table[ 3 * 256 + ( v >> 32 & 0xff ) ] ^ table[ 2 * 256 + ( v >> 40 & 0xff ) ] ^
+                  table[ 1 * 256 + ( v >> 48 & 0xff ) ] ^ table[ v >> 56 ];
+        }
+        for( ; len; --len ) crc = ( crc >> 8 ) ^ table[ ( crc ^ *p++ ) & 0xff ];
+        return ~crc;
+    }
+
+    // XXH64
+    static uint64_t hash64( const void *ptr, size_t len, uint64_t seed = 0 ) {
+        const uint64_t p1 = 0x9E3779B185EBCA87ULL, p2 = 0xC2B2AE3D27D4EB4FULL, p3 = 0x165667B19E3779F9ULL;
+        const uint64_t p4 = 0x85EBCA77C2B2AE63ULL, p5 = 0x27D4EB2F165667C5ULL;
+        auto rotl = []( uint64_t x, int r ) { return ( x << r ) | ( x >> ( 64 - r ) ); };
+        auto round = [&]( uint64_t acc, uint64_t in ) { return rotl( acc + in * p2, 31 ) * p1; };
+        auto merge = [&]( uint64_t acc, uint64_t v ) { return ( acc ^ round( 0, v ) ) * p1 + p4; };
+        const unsigned char *p = (const unsigned char *)ptr, *end = p + len;
+        uint64_t h;
+        if( len >= 32 ) {
+            uint64_t v1 = seed + p1 + p2, v2 = seed + p2, v3 = seed, v4 = seed - p1;
+            for( ; p + 32 <= end; p += 32 ) {
+                v1 = round( v1, get64( p ) ), v2 = round( v2, get64( p + 8 ) );
+                v3 = round( v3, get64( p + 16 ) ), v4 = round( v4, get64( p + 24 ) );
+            }
+            h = rotl( v1, 1 ) + rotl( v2, 7 ) + rotl( v3, 12 ) + rotl( v4, 18 );
+            h = merge( merge( merge( merge( h, v1 ), v2 ), v3 ), v4 );
+        } else {
+            h = seed + p5;
+        }
+        h += len;
+        for( ; p + 8 <= end; p += 8 ) h = rotl( h ^ round( 0, get64( p ) ), 27 ) * p1 + p4;
+        for( ; p + 4 <= end; p += 4 ) h = rotl( h ^ ( get64( p, 4 ) * p1 ), 23 ) * p2 + p3;
+        for( ; p < end; ++p ) h = rotl( h ^ ( *p * p5 ), 11 ) * p1;
+        h = ( h ^ ( h >> 33 ) ) * p2;
+        h = ( h ^ ( h >> 29 ) ) * p3;
+        return h ^ ( h >> 32 );
+    }
+
+    // hchacha20: a subkey out of a key and 128 bits of nonce, as the first half of xchacha20 (the
+    // chacha20 rounds, without their final addition). empty on bad keys.
+    static std::string hchacha20( const std::string &key, const uint64_t salt[2] ) {
+        const uint32_t sigma[4] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+        uint32_t k[8], in[4] = { uint32_t( salt[0] ), uint32_t( salt[0] >> 32 ), uint32_t( salt[1] ), uint32_t( salt[1] >> 32 ) }, out[16];
+        std::string subkey;
+        if( key.size() != 32 ) {
+            return subkey;
+        }
+        for( int i = 0; i < 8; ++i ) k[i] = uint32_t( get64( &key[ i * 4 ], 4 ) );
+        chacha20( k, in[1], uint64_t( in[3] ) << 32 | in[2], in[0], out );
+        for( int i = 0; i < 8; ++i ) {
+            uint32_t v = i < 4 ? out[i] - sigma[i] : out[i + 8] - in[i - 4];
+            for( int b = 0; b < 4; ++b ) subkey += char( v >> ( b * 8 ) );
+        }
+        return subkey;
+    }
+
+    // chacha20-poly1305 (rfc 8439), in place: encrypts 'data' and writes its 16-byte tag, or checks the tag
+    // and decrypts. 'key' holds 32 bytes, and the 96-bit nonce is [32-bit domain][64-bit nonce]. returns
+    // false on bad keys, and on data that does not authenticate (which is left as is).
+    static bool chacha20_poly1305( const std::string &key, uint32_t domain, uint64_t nonce, char *data, size_t len, char tag[16], bool encrypt,
+                                   const std::string &aad = std::string() ) {
+        uint32_t k[8], block[16];
+        if( key.size() != 32 ) {
+            return false;
+        }
+        for( int i = 0; i < 8; ++i ) k[i] = uint32_t( get64( &key[ i * 4 ], 4 ) );
+        chacha20( k, domain, nonce, 0, block );
+        unsigned char otk[32], mac[16], lengths[16], zeros[16] = {};
+        for( int i = 0; i < 32; ++i ) otk[i] = (unsigned char)( block[ i / 4 ] >> ( i % 4 * 8 ) );
+        for( int i = 0; i < 16; ++i ) lengths[i] = (unsigned char)( ( i < 8 ? uint64_t( aad.size() ) : uint64_t( len ) ) >> ( i % 8 * 8 ) );
+        poly1305 auth( otk );
+        auth.update( aad.data(), aad.size() );
+        auth.update( zeros, pad( aad.size(), 16 ) );
+        // the keystream starts at block 1 (block 0 keys poly1305). slices are encrypted and authenticated
+        // while still in cache.
+        for( size_t at = 0, n; at < len; at += n ) {
+            n = len - at < size_t( 16 << 10 ) ? len - at : size_t( 16 << 10 );
+            if( encrypt ) chacha20_xor( k, domain, nonce, uint32_t( 1 + at / 64 ), data + at, n );
+            auth.update( data + at, n );
+        }
+        auth.update( zeros, pad( len, 16 ) );
+        auth.update( lengths, 16 );
+        auth.finish( mac );
+        if( encrypt ) {
+            return memcpy( tag, mac, 16 ), true;
+        }
+        unsigned char diff = 0;
+        for( int i = 0; i < 16; ++i ) diff |= mac[i] ^ (unsigned char)tag[i];
+        if( diff ) {
+            return false;
+        }
+        chacha20_xor( k, domain, nonce, 1, data, len );
+        return true;
+    }
+
+#ifdef JOURNEY_POSIX
+    // compacts the journal in place while other writers keep appending to it. the toc is snapshot at
+    // the current end of file, that prefix is compacted into a sibling file, and then the tail written
+    // meanwhile is copied over in rounds. writers only block for the final catch-up, right before the
+    // sibling atomically replaces the journal through rename(). plain (unsegmented) journals only. fails
+    // if the tail holds delta entries against versions in the prefix (delta_chain), links to entries
+    // there, or entries aligned beyond 'align', and while another compaction of the journal runs.
+    // a loaded toc is reloaded afterwards, as its offsets are stale; other loaded journeys of the
+    // journal must load() again before they read from it.
+    bool compact_in_place() {
+        uint64_t at;
+        int lock = -1;
+        if( !release_sibling( lock, compact_prefix( at, lock ) && compact_tail( at ) ) ) {
+            return false;
+        }
+        if( !files.empty() ) {
+            load( loaded_range[0], loaded_range[1] );
+        }
+        return true;
+    }
+#endif
+
+    // bytes at the end of the journal that the last load() skipped, as they do not end in a valid entry:
+    // the torn tail of an append cut short by a crash (0 if none). load() resynchronizes past torn tails,
+    // and past garbage in between entries (ie, appended after an unrepaired torn tail), to the nearest
+    // entries that check out. garbage in between entries is only skipped when it is under 1 MiB, so a
+    // torn tail should be repair()ed before appending to the journal again.
+    uint64_t torn() const {
+        return torn_bytes;
+    }
+
+#ifdef JOURNEY_POSIX
+    // cuts the torn tail off the journal (its last segment), under the append lock, so that appends
+    // follow the last good entry again. fails if there is no entry to cut back to.
+    bool repair() {
+        std::string file = segments().back();
+        int fd = open_locked( file, O_WRONLY, false );
+        struct stat st;
+        uint64_t size = 0, start, end = 0;
+        if( fd >= 0 && 0 == fstat( fd, &st ) ) {
+            std::ifstream ifs( file.c_str(), std::ios::binary );
+            size = st.st_size;
+            end = !size || ends_entry( ifs, size, start ) ? size : resync( ifs, file, size, true );
+        }
+        bool ok = fd >= 0 && ( end == size || ( end && 0 == ftruncate( fd, end ) ) );
+        if( fd >= 0 ) ok = ( 0 == close( fd ) ) && ok;
+        if( ok ) {
+            bytes_total -= size - end;
+            torn_bytes = 0;
+        }
+        return ok;
+    }
+#endif
+
+    // releases any space preallocated past the end of the journal, under the append lock
+    bool trim() const {
+        return trim_file( segments().back() );
+    }
+
+    // appends the live entries to another journal. the output layout is computed up front from the
+    // toc, then 'threads' workers stream disjoint ranges of it in parallel, through fixed-size buffers
+    // (or copy_file_range), at up to 'compaction_rate' bytes per second. entries are copied in journal
+    // order, and runs of adjacent entries as single extents.
+    bool compact( const std::string &new_journal_file ) const {
+        selection live;
+        for( auto &it : toc ) {
+            live.push_back( std::make_pair( &it.first, it.second ) );
+        }
+        return !live.empty() && write_selection( new_journal_file, live, files, bases, parts );
+    }
+
+    // which versions compact() keeps when given a retention policy. a version survives when any rule
+    // keeps it, unless it is older than max_age. the latest version of every name is always kept.
+    struct retention {
+        unsigned versions = 1;          // latest versions of every name
+        unsigned daily = 0;             // newest version of each of the last 'daily' days
+        unsigned weekly = 0;            // newest version of each of the last 'weekly' weeks
+        uint64_t max_age = 0;           // in seconds (0 = unlimited)
+        uint64_t now = std::time(0);
+    };
+
+    // appends the versions kept by a retention policy to another journal, in a single streaming pass
+    // over the whole journal (the toc is not used, so no load() is needed).
+    bool compact( const std::string &new_journal_file, const retention &policy ) const {
+        std::map< std::string, std::vector<entry> > versions;
+        std::map< std::string, entry > parts;
+        std::vector<std::string> list;
+        std::vector<uint64_t> offsets;
+        if( !scan_all( list, offsets, [&]( const std::string &name, const entry &e ) {
+            return name[0] ? ( versions[ name ].push_back( e ), true ) : ( add_part( parts, name, e ), false );
+        } ) ) {
+            return false;
+        }
+        selection kept = retained( versions, policy );
+        return !kept.empty() && write_selection( new_journal_file, kept, list, offsets, parts );
+    }
+
+    // what a compaction would do, as estimated by plan_compaction()
+    struct plan {
+        uint64_t input = 0;             // bytes in the journal, segments included
+        uint64_t output = 0;            // bytes written into a new journal
+        uint64_t reclaimable = 0;       // input - output, if positive
+        uint64_t entries = 0;           // entries kept
+        double seconds = 0;             // time to write the output, at 'bytes_per_second'
+        bool ok = true;                 // false if the journal could not be read, leaving a partial estimate
+    };
+
+    // dry run of compact(), out of the toc loaded by load(). data blocks are not read (but for the chunk
+    // lists of chunked entries), and the last segment is only opened for its size.
+    plan plan_compaction( uint64_t bytes_per_second = 0 ) const {
+        selection live;
+        for( auto &it : toc ) {
+            live.push_back( std::make_pair( &it.first, it.second ) );
+        }
+        return plan_of( live, files, bases, parts, bytes_per_second );
+    }
+
+    // dry run of compact() with a retention policy, out of an index-only scan: info blocks and names are
+    // read, data blocks are not (but for the chunk lists of chunked entries). no load() is needed.
+    plan plan_compaction( const retention &policy, uint64_t bytes_per_second = 0 ) const {
+        std::map< std::string, std::vector<entry> > versions;
+        std::map< std::string, entry > parts;
+        std::vector<std::string> list;
+        std::vector<uint64_t> offsets;
+        bool ok = scan_all( list, offsets, [&]( const std::string &name, const entry &e ) {
+            return name[0] ? ( versions[ name ].push_back( e ), true ) : ( add_part( parts, name, e ), false );
+        } );
+        selection kept = retained( versions, policy );
+        plan p = plan_of( kept, list, offsets, parts, bytes_per_second );
+        p.ok = p.ok && ok;
+        return p;
+    }
+
+    // merges several journals into a new one, keeping only the newest version of every name (later
+    // inputs win ties). inputs are indexed by up to 'workers' threads in parallel, then their tocs are
+    // merged in name order and every winner is streamed into the output exactly once. fails if any
+    // input cannot be loaded.
+    static bool merge( const std::vector<std::string> &inputs, const std::string &output, unsigned workers = 1 ) {
+        std::vector<journey> js( inputs.size() );
+        std::vector<char> loaded( inputs.size(), 0 );
+        workers = workers < 1 ? 1 : ( workers > inputs.size() ? unsigned( inputs.size() ) : workers );
+        auto work = [&]( unsigned w ) {
+            for( size_t i = w; i < js.size(); i += workers ) {
+                loaded[i] = js[i].init( inputs[i] ) && js[i].load( 0, ~0ull );
+            }
+        };
+        std::vector<std::thread> pool;
+        for( unsigned w = 1; w < workers; ++w ) {
+            pool.push_back( std::thread( work, w ) );
+        }
+        work( 0 );
+        for( auto &t : pool ) {
+            t.join();
+        }
+        if( std::count( loaded.begin(), loaded.end(), 0 ) ) {
+            return false;
+        }
+        // inputs are laid out one after another, as if they were concatenated
+        std::vector<std::string> list;
+        std::vector<uint64_t> offsets, shift;
+        std::map<std::string, entry> parts;
+        uint64_t base = 0;
+        for( auto &j : js ) {
+            shift.push_back( base );
+            for( size_t k = 0; k < j.files.size(); ++k ) {
+                list.push_back( j.files[k] );
+                offsets.push_back( base + j.bases[k] );
+            }
+            for( auto &it : j.parts ) {
+                entry e = it.second;
+                e.offset += base, e.begin += base, e.end += base;
+                add_part( parts, it.first, e );
+            }
+            base += j.files.empty() ? 0 : j.bases.back() + file_size( j.files.back() );
+        }
+        typedef std::pair< std::map<std::string, entry>::const_iterator, size_t > cursor;
+        auto after = []( const cursor &a, const cursor &b ) {
+            return a.first->first != b.first->first ? a.first->first > b.first->first : a.second > b.second;
+        };
+        std::priority_queue< cursor, std::vector<cursor>, decltype(after) > heap( after );
+        for( size_t i = 0; i < js.size(); ++i ) {
+            if( !js[i].toc.empty() ) heap.push( cursor( js[i].toc.begin(), i ) );
+        }
+        selection winners;
+        while( !heap.empty() ) {
+            cursor best = heap.top();
+            for( const std::string &name = best.first->first; !heap.empty() && heap.top().first->first == name; ) {
+                cursor c = heap.top();
+                heap.pop();
+                if( c.first->second.stamp >= best.first->second.stamp ) {
+                    best = c;
+                }
+                if( ++c.first != js[c.second].toc.end() ) {
+                    heap.push( c );
+                }
+            }
+            entry e = best.first->second;
+            e.offset += shift[best.second], e.begin += shift[best.second], e.end += shift[best.second];
+            // newer tombstones of other inputs delete it
+            bool deleted = false;
+            for( size_t i = 0; i < js.size() && !deleted; ++i ) {
+                auto found = js[i].erased.find( best.first->first );
+                deleted = i != best.second && found != js[i].erased.end() && found->second.stamp >= e.stamp;
+                for( auto &p : js[i].erased_prefixes ) {
+                    deleted = deleted || ( i != best.second && p.second.stamp >= e.stamp && !best.first->first.compare( 0, p.first.size(), p.first ) );
+                }
+            }
+            if( !deleted ) {
+                winners.push_back( std::make_pair( &best.first->first, e ) );
+            }
+        }
+        journey j;
+        j.threads = workers;
+        return !winners.empty() && j.write_selection( output, winners, list, offsets, parts );
+    }
+
+    // versions of a name kept by a policy, newest first
+    static std::vector<entry> retain( std::vector<entry> versions, const retention &policy ) {
+        std::stable_sort( versions.begin(), versions.end(), []( const entry &a, const entry &b ) {
+            return a.stamp != b.stamp ? a.stamp > b.stamp : a.begin > b.begin;
+        } );
+        std::vector<entry> kept;
+        uint64_t today = policy.now / 86400, last_day = ~0ull, last_week = ~0ull;
+        for( size_t i = 0; i < versions.size(); ++i ) {
+            uint64_t day = versions[i].stamp / 86400, week = day / 7;
+            bool keep = i < policy.versions;
+            keep = keep || ( day != last_day && day + policy.daily > today );
+            keep = keep || ( week != last_week && week + policy.weekly > today / 7 );
+            keep = keep && !( policy.max_age && versions[i].stamp + policy.max_age < policy.now );
+            if( keep || !i ) {
+                kept.push_back( versions[i] );
+            }
+            last_day = day, last_week = week;
+        }
+        return kept;
+    }
+
+    protected:
+    enum { page = 4096, max_align = 2 << 20 };
+
+    // chacha20 block function: the keystream block 'counter' of a key and nonce
+    static void chacha20( const uint32_t key[8], uint32_t domain, uint64_t nonce, uint32_t counter, uint32_t out[16] ) {
+        uint32_t s[16] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574, key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+                           counter, domain, uint32_t( nonce ), uint32_t( nonce >> 32 ) }, x[16];
+        memcpy( x, s, sizeof(x) );
+        auto quarter = [&x]( int a, int b, int c, int d ) {
+            x[a] += x[b]; x[d] ^= x[a]; x[d] = x[d] << 16 | x[d] >> 16;
+            x[c] += x[d]; x[b] ^= x[c]; x[b] = x[b] << 12 | x[b] >> 20;
+            x[a] += x[b]; x[d] ^= x[a]; x[d] = x[d] << 8 | x[d] >> 24;
+            x[c] += x[d]; x[b] ^= x[c]; x[b] = x[b] << 7 | x[b] >> 25;
+        };
+        for( int round = 0; round < 10; ++round ) {
+            quarter( 0, 4, 8, 12 ), quarter( 1, 5, 9, 13 ), quarter( 2, 6, 10, 14 ), quarter( 3, 7, 11, 15 );
+            quarter( 0, 5, 10, 15 ), quarter( 1, 6, 11, 12 ), quarter( 2, 7, 8, 13 ), quarter( 3, 4, 9, 14 );
+        }
+        for( int i = 0; i < 16; ++i ) out[i] = x[i] + s[i];
+    }
+
+    static uint32_t le32( const unsigned char *p ) {
+        return uint32_t( p[0] ) | uint32_t( p[1] ) << 8 | uint32_t( p[2] ) << 16 | uint32_t( p[3] ) << 24;
+    }
+
+    static void xor32( char *p, uint32_t v ) {
+        unsigned char *q = (unsigned char *)p;
+        v ^= le32( q );
+        q[0] = (unsigned char)v, q[1] = (unsigned char)( v >> 8 ), q[2] = (unsigned char)( v >> 16 ), q[3] = (unsigned char)( v >> 24 );
+    }
+
+#if defined(__GNUC__) || defined(__clang__)
+    // chacha20 keystream for as many blocks as a vector type has lanes, xored into data: one block per lane
+    template<typename V, int N>
+    __attribute__(( always_inline )) static inline void chacha20_lanes( const uint32_t key[8], uint32_t domain, uint64_t nonce, uint32_t counter, char *data ) {
+        const uint32_t words[16] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574, key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+                                     0, domain, uint32_t( nonce ), uint32_t( nonce >> 32 ) };
+        V s[16], x[16];
+        for( int i = 0; i < 16; ++i ) {
+            for( int j = 0; j < N; ++j ) s[i][j] = words[i] + ( i == 12 ? counter + j : 0 );
+            x[i] = s[i];
+        }
+        auto quarter = []( V &a, V &b, V &c, V &d ) {
+            a += b; d ^= a; d = d << 16 | d >> 16;
+            c += d; b ^= c; b = b << 12 | b >> 20;
+            a += b; d ^= a; d = d << 8 | d >> 24;
+            c += d; b ^= c; b = b << 7 | b >> 25;
+        };
+        for( int round = 0; round < 10; ++round ) {
+            quarter( x[0], x[4], x[8], x[12] ), quarter( x[1], x[5], x[9], x[13] ), quarter( x[2], x[6], x[10], x[14] ), quarter( x[3], x[7], x[11], x[15] );
+            quarter( x[0], x[5], x[10], x[15] ), quarter( x[1], x[6], x[11], x[12] ), quarter( x[2], x[7], x[8], x[13] ), quarter( x[3], x[4], x[9], x[14] );
+        }
+        for( int i = 0; i < 16; ++i ) {
+            x[i] += s[i];
+            for( int j = 0; j < N; ++j ) xor32( data + j * 64 + i * 4, x[i][j] );
+        }
+    }
+
+    typedef uint32_t lanes4 __attribute__(( vector_size( 16 ) ));
+    typedef uint32_t lanes8 __attribute__(( vector_size( 32 ) ));
+
+#ifdef JOURNEY_SSE42
+    __attribute__(( target( "avx2" ) )) static size_t chacha20_avx2( const uint32_t key[8], uint32_t domain, uint64_t nonce, uint32_t counter, char *data, size_t len ) {
+        size_t done = 0;
+        for( ; len - done >= 512; done += 512, counter += 8 ) chacha20_lanes<lanes8, 8>( key, domain, nonce, counter, data + done );
+        return done;
+    }
+#endif
+#endif
+
+    // xors data with the chacha20 keystream, from block 'counter' on. blocks are computed in vector lanes
+    // where the compiler has vector extensions, 8 at once on cpus with avx2.
+    static void chacha20_xor( const uint32_t key[8], uint32_t domain, uint64_t nonce, uint32_t counter, char *data, size_t len ) {
+        uint32_t block[16];
+#if defined(__GNUC__) || defined(__clang__)
+#ifdef JOURNEY_SSE42
+        static const bool avx2 = __builtin_cpu_supports( "avx2" );
+        if( avx2 ) {
+            size_t done = chacha20_avx2( key, domain, nonce, counter, data, len );
+            counter += uint32_t( done / 64 ), data += done, len -= done;
+        }
+#endif
+        for( ; len >= 256; counter += 4, data += 256, len -= 256 ) {
+            chacha20_lanes<lanes4, 4>( key, domain, nonce, counter, data );
+        }
+#endif
+        for( ; len; ++counter ) {
+            chacha20( key, domain, nonce, counter, block );
+            size_t n = len < 64 ? len : 64, i = 0;
+            for( ; i + 4 <= n; i += 4 ) xor32( data + i, block[ i / 4 ] );
+            for( ; i < n; ++i ) data[i] ^= char( block[ i / 4 ] >> ( i % 4 * 8 ) );
+            data += n, len -= n;
+        }
+    }
+
+    // poly1305 one-time authenticator, in 26-bit limbs
+    struct poly1305 {
+        uint32_t r[5], h[5] = {}, pad[4];
+        unsigned char buf[16];
+        size_t used = 0;
+        explicit poly1305( const unsigned char key[32] ) {
+            r[0] = uint32_t( le32( key + 0 ) ) & 0x3ffffff;
+            r[1] = uint32_t( le32( key + 3 ) >> 2 ) & 0x3ffff03;
+            r[2] = uint32_t( le32( key + 6 ) >> 4 ) & 0x3ffc0ff;
+            r[3] = uint32_t( le32( key + 9 ) >> 6 ) & 0x3f03fff;
+            r[4] = uint32_t( le32( key + 12 ) >> 8 ) & 0x00fffff;
+            for( int i = 0; i < 4; ++i ) pad[i] = le32( key + 16 + i * 4 );
+        }
+        void blocks( const unsigned char *m, size_t n, uint32_t hibit ) {
+            const uint64_t r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3], r4 = r[4], s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+            uint64_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4], c;
+            for( ; n--; m += 16 ) {
+                h0 += le32( m + 0 ) & 0x3ffffff;
+                h1 += le32( m + 3 ) >> 2 & 0x3ffffff;
+                h2 += le32( m + 6 ) >> 4 & 0x3ffffff;
+                h3 += le32( m + 9 ) >> 6 & 0x3ffffff;
+                h4 += le32( m + 12 ) >> 8 | hibit;
+                uint64_t d0 = h0 * r0 + h1 * s4 + h2 * s3 + h3 * s2 + h4 * s1;
+                uint64_t d1 = h0 * r1 + h1 * r0 + h2 * s4 + h3 * s3 + h4 * s2;
+                uint64_t d2 = h0 * r2 + h1 * r1 + h2 * r0 + h3 * s4 + h4 * s3;
+                uint64_t d3 = h0 * r3 + h1 * r2 + h2 * r1 + h3 * r0 + h4 * s4;
+                uint64_t d4 = h0 * r4 + h1 * r3 + h2 * r2 + h3 * r1 + h4 * r0;
+                c = d0 >> 26, h0 = d0 & 0x3ffffff, d1 += c;
+                c = d1 >> 26, h1 = d1 & 0x3ffffff, d2 += c;
+                c = d2 >> 26, h2 = d2 & 0x3ffffff, d3 += c;
+                c = d3 >> 26, h3 = d3 & 0x3ffffff, d4 += c;
+                c = d4 >> 26, h4 = d4 & 0x3ffffff, h0 += c * 5;
+                c = h0 >> 26, h0 &= 0x3ffffff, h1 += c;
+            }
+            h[0] = uint32_t( h0 ), h[1] = uint32_t( h1 ), h[2] = uint32_t( h2 ), h[3] = uint32_t( h3 ), h[4] = uint32_t( h4 );
+        }
+        void update( const void *ptr, size_t len ) {
+            const unsigned char *p = (const unsigned char *)ptr;
+            if( used ) {
+                size_t n = len < 16 - used ? len : 16 - used;
+                memcpy( buf + used, p, n );
+                used += n, p += n, len -= n;
+                if( used < 16 ) return;
+                blocks( buf, 1, 1 << 24 );
+                used = 0;
+            }
+            blocks( p, len / 16, 1 << 24 );
+            memcpy( buf, p + len / 16 * 16, used = len % 16 );
+        }
+        void finish( unsigned char mac[16] ) {
+            if( used ) {
+                buf[ used++ ] = 1;
+                memset( buf + used, 0, 16 - used );
+                blocks( buf, 1, 0 );
+            }
+            uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4], c, g[5], mask;
+            c = h1 >> 26, h1 &= 0x3ffffff, h2 += c;
+            c = h2 >> 26, h2 &= 0x3ffffff, h3 += c;
+            c = h3 >> 26, h3 &= 0x3ffffff, h4 += c;
+            c = h4 >> 26, h4 &= 0x3ffffff, h0 += c * 5;
+            c = h0 >> 26, h0 &= 0x3ffffff, h1 += c;
+            // h - p, kept if h >= p
+            g[0] = h0 + 5, c = g[0] >> 26, g[0] &= 0x3ffffff;
+            g[1] = h1 + c, c = g[1] >> 26, g[1] &= 0x3ffffff;
+            g[2] = h2 + c, c = g[2] >> 26, g[2] &= 0x3ffffff;
+            g[3] = h3 + c, c = g[3] >> 26, g[3] &= 0x3ffffff;
+            g[4] = h4 + c - ( 1u << 26 );
+            mask = ( g[4] >> 31 ) - 1;
+            h0 = ( h0 & ~mask ) | ( g[0] & mask ), h1 = ( h1 & ~mask ) | ( g[1] & mask ), h2 = ( h2 & ~mask ) | ( g[2] & mask );
+            h3 = ( h3 & ~mask ) | ( g[3] & mask ), h4 = ( h4 & ~mask ) | ( g[4] & mask );
+            uint32_t w[4] = { h0 | h1 << 26, h1 >> 6 | h2 << 20, h2 >> 12 | h3 << 14, h3 >> 18 | h4 << 8 };
+            uint64_t f = 0;
+            for( int i = 0; i < 4; ++i ) {
+                f = ( f >> 32 ) + w[i] + pad[i];
+                for( int b = 0; b < 4; ++b ) mac[ i * 4 + b ] = (unsigned char)( f >> ( b * 8 ) );
+            }
+        }
+    };
+
+    // names starting with '\0' are reserved for internal entries (like segment manifests)
+    static std::string reserved( const char *tag ) {
+        return std::string( 1, '\0' ) + tag;
+    }
+
+    static uint64_t file_size( const std::string &file ) {
+        std::ifstream ifs( file.c_str(), std::ios::binary | std::ios::ate );
+        return ifs.good() ? uint64_t( ifs.tellg() ) : 0;
+    }
+
+    // visits every entry of a file, walking backwards from 'limit' (or its end, if smaller) down to the
+    // first one. fillers are folded into the entry right after them, so entries are only visited once
+    // their tags are known. data blocks are never read. 'visit( name, entry )' returns whether the
+    // entry was inscribed, which is only used for debugging. entries that do not check out make the scan
+    // resynchronize past them (see resync()), and 'torn' receives the bytes skipped at the very end, if
+    // any. returns false on i/o errors.
+    template<typename F>
+    bool scan_file( const std::string &file, uint64_t base, F visit, std::ostream *debugstream = 0, uint64_t limit = ~0ull,
+                    uint64_t *torn = 0 ) const {
+        std::ifstream ifs( file.c_str(), std::ios::binary | std::ios::ate );
+        if( !ifs.is_open() ) {
+            return true;
+        }
+        uint64_t pos = uint64_t( ifs.tellg() ) < limit ? uint64_t( ifs.tellg() ) : limit, last = pos, resumed;
+        std::string name, brief, tags, varint_tags;
+        entry pending = entry();
+        std::vector< std::pair<std::string, entry> > records;
+        auto note = [&]( const std::string &name, const entry &e ) {
+            bool inscribed = visit( name, e );
+            if( debugstream ) {
+                const char *action[2] = { "skipped", "inscribed" };
+                *debugstream << "v1 - " << action[inscribed] << " '" << name << "' " << e.size << " datalen; stamp=" << e.stamp << "; brief=" << brief << std::endl;
+            }
+        };
+        auto flush = [&] {
+            if( !name.empty() ) {
+                // encrypted names are listed as stored (hex), unless the key is known
+                if( pending.sealed & 1 && !key.empty() ) unseal_name( name, pending.sealed, pending.salt, pending.stamp );
+                // packs are visited as their records, newest first
+                if( name == reserved( "pack" ) && read_pack( ifs, pending.offset - base, pending, records ) ) {
+                    for( auto it = records.rbegin(); it != records.rend(); ++it ) note( it->first, it->second );
+                } else if( !pending.link || linked( file, base, pending ) ) {
+                    // links are visited as the entry they share, unless that cannot be found
+                    note( name, pending );
+                }
+                name.clear();
+            }
+        };
+        while( ifs.good() && pos >= 8 ) {
+            uint64_t block[5], stamp, namelen, datalen, start, namepos, datapos;
+            if( trailer3( ifs, pos, stamp, namelen, datalen, start, varint_tags ) ) {
+                namepos = start, datapos = start + namelen;
+            } else if( pos >= 8*5 && ifs.seekg( pos - 8*5 ).read( (char *)block, sizeof(block) ) && info_block( block, pos, start, namepos, datapos ) ) {
+                stamp = block[0], namelen = block[1], datalen = block[2];
+                varint_tags.clear();
+            } else if( ( resumed = resync( ifs, file, pos, pos == last ) ) != 0 ) {
+                // the entry in front of the garbage is not described by whatever filler comes before it
+                flush();
+                if( torn && pos == last ) *torn = pos - resumed;
+                if( debugstream ) *debugstream << "v1 - resynchronized past " << pos - resumed << " bytes at " << resumed << std::endl;
+                pos = resumed;
+                continue;
+            } else {
+                break;
+            }
+            if( !namelen ) {
+                // filler: its tags (if any) describe the entry right after it
+                if( !name.empty() ) {
+                    ifs.seekg( datapos );
+                    if( read_tags( ifs, datalen, tags ) ) {
+                        apply_tags( pending, tags );
+                    }
+                    pending.begin = base + start;
+                }
+                flush();
+            } else {
+                flush();
+                name.resize( namelen );
+                ifs.seekg( namepos ).read( &name[0], namelen );
+                pending = entry{ base + datapos, datalen, stamp, 0, base + start, base + pos, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, { 0, 0 } };
+                apply_tags( pending, varint_tags );
+                if( debugstream ) {
+                    brief.assign( datalen > 16 ? 16 : datalen, '\0' );
+                    ifs.seekg( datapos ).read( &brief[0], brief.size() );
+                }
+            }
+            pos = start;
+        }
+        flush();
+        return ifs.good();
+    }
+
+    // segment files of the journal, and their logical offsets
+    void resolve( std::vector<std::string> &list, std::vector<uint64_t> &offsets ) const {
+        uint64_t base = 0;
+        list = segments();
+        offsets.clear();
+        for( auto &file : list ) {
+            offsets.push_back( base );
+            base += file_size( file );
+        }
+    }
+
+    // scans every segment, newest first
+    template<typename F>
+    bool scan_all( std::vector<std::string> &list, std::vector<uint64_t> &offsets, F visit ) const {
+        bool ok = true;
+        resolve( list, offsets );
+        for( size_t i = list.size(); i-- > 0; ) {
+            ok = scan_file( list[i], offsets[i], visit ) && ok;
+        }
+        return ok;
+    }
+
+    bool load_file( const std::string &file, uint64_t base, uint64_t beg_stamp, uint64_t end_stamp, std::ostream *debugstream, unsigned &count,
+                    uint64_t limit = ~0ull, uint64_t *torn = 0 ) {
+        return scan_file( file, base, [&]( const std::string &name, const entry &e ) {
+            // '\0' prefixed names are internal: never inscribed
+            count ++;
+            if( add_part( parts, name, e ) ) {
+                bytes_live += e.end - e.begin;
+                active = active || name.compare( 0, 12, reserved( "dictionary:" ) ) ? active : e.hash;
+            }
+            // tombstones hide the versions written before them (visited after them)
+            bool ranged = name[0] && e.stamp >= beg_stamp && e.stamp <= end_stamp, hidden = erased.count( name ) > 0;
+            for( size_t i = 0; i < erased_prefixes.size() && !hidden; ++i ) {
+                hidden = !name.compare( 0, erased_prefixes[i].first.size(), erased_prefixes[i].first );
+            }
+            if( ranged && !hidden && e.tombstone == 1 && !toc.count( name ) ) {
+                erased.insert( std::make_pair( name, e ) );
+            }
+            if( ranged && e.tombstone == 2 ) {
+                erased_prefixes.push_back( std::make_pair( name, e ) );
+            }
+            bool inscribed = ranged && !hidden && !e.tombstone && toc.insert( std::make_pair( name, e ) ).second;
+            bytes_live += inscribed ? ( e.packed ? e.size : e.end - e.begin ) : 0;
+            if( inscribed && e.hash ) {
+                hashed.insert( std::make_pair( e.hash, name ) );
+            }
+            return inscribed;
+        }, debugstream, limit, torn );
+    }
+
+    // lists the records of a pack, whose data block is at 'datapos' of a stream. packs hold a [varint
+    // size][table] block, listing [varint name length][name][varint stamp][varint size] for every record,
+    // and then the data of every record, in the same order.
+    static bool read_pack( std::istream &is, uint64_t datapos, const entry &pack, std::vector< std::pair<std::string, entry> > &records ) {
+        std::string table, head;
+        records.clear();
+        if( pack.raw || pack.chunked || pack.delta || !is.seekg( datapos ) || !read_tags( is, pack.size, table ) ) {
+            return false;
+        }
+        put_varint( head, table.size() );
+        const char *p = table.data(), *end = p + table.size();
+        uint64_t at = pack.offset + head.size() + table.size(), stop = pack.offset + pack.size;
+        for( uint64_t namelen, stamp, size; p < end; at += size ) {
+            if( !get_varint( p, end, namelen ) || !namelen || namelen > uint64_t( end - p ) || !*p ) {
+                return false;
+            }
+            std::string name( p, namelen );
+            p += namelen;
+            if( !get_varint( p, end, stamp ) || !get_varint( p, end, size ) || size > stop - at ) {
+                return false;
+            }
+            records.push_back( std::make_pair( name, entry{ at, size, stamp, 0, pack.begin, pack.end, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, { 0, 0 } } ) );
+        }
+        return true;
+    }
+
+    // resolves a link (as scanned from a file) to the data it shares: that of the entry it points at, or
+    // of the record of that pack named by the data of the link. links to links are followed. the link
+    // keeps its own stamp and extent, and its delta distance (if any) is rebased to its own begin. links
+    // to encrypted entries are not resolved, as their data is bound to the name it was written under.
+    bool linked( const std::string &file, uint64_t base, entry &e ) const {
+        std::vector<std::string> list( 1, file );
+        std::vector<uint64_t> offsets( 1, base );
+        std::vector< std::pair<std::string, entry> > records;
+        std::ifstream ifs( file.c_str(), std::ios::binary );
+        entry at = e;
+        for( unsigned hops = 0; at.link && hops < 64; ++hops ) {
+            std::string target( at.size, '\0' ), name;
+            if( at.link >= at.begin + 1 - base || !read_at( list, offsets, at.offset, target ) || !entry_at( list, offsets, at.begin + 1 - at.link, at, &name ) ) {
+                return false;
+            }
+            if( name == reserved( "pack" ) && read_pack( ifs, at.offset - base, at, records ) ) {
+                auto found = std::find_if( records.rbegin(), records.rend(), [&]( const std::pair<std::string, entry> &r ) { return r.first == target; } );
+                if( found == records.rend() ) {
+                    return false;
+                }
+                at = found->second;
+            } else if( name != target || at.tombstone ) {
+                return false;
+            }
+        }
+        if( at.link || at.sealed ) {
+            return false;
+        }
+        uint64_t delta = at.delta ? e.begin - at.begin + at.delta : 0;
+        at.stamp = e.stamp, at.begin = e.begin, at.end = e.end, at.link = e.link, at.delta = delta, at.packed = 0;
+        return e = at, true;
+    }
+
+    // reads the name of the last entry in a file, and locates its data block
+    bool tail_entry( const std::string &file, std::string &name, uint64_t &datapos, uint64_t &datalen ) const {
+        std::ifstream ifs( file.c_str(), std::ios::binary | std::ios::ate );
+        uint64_t size = ifs.good() ? uint64_t( ifs.tellg() ) : 0, block[5], start, namepos;
+        if( size < 8*5 || !ifs.seekg( size - 8*5 ).read( (char *)block, sizeof(block) ) || !info_block( block, size, start, namepos, datapos ) ) {
+            return false;
+        }
+        name.resize( block[1] );
+        ifs.seekg( namepos ).read( &name[0], block[1] );
+        datalen = block[2];
+        return ifs.good();
+    }
+
+    // finds a name in the toc, or else in the footer index of a sealed journal
+    bool find( const std::string &name, entry &e ) const {
+        auto found = toc.find( name );
+        if( found != toc.end() ) {
+            return e = found->second, true;
+        }
+        if( !footer ) {
+            return false;
+        }
+        const char *p = footer.get(), *records = p + 8*3;
+        uint64_t count = get64( p ), bloom = get64( p + 8 ), hashes = get64( p + 16 ), h = hash64( name.data(), name.size() );
+        const char *bits = records + count * 8*10, *names = bits + bloom;
+        for( uint64_t i = 0, bit; i < hashes; ++i ) {
+            bit = ( h + i * ( ( h >> 33 ) | 1 ) ) % ( bloom * 8 );
+            if( !( bits[ bit / 8 ] & ( 1 << bit % 8 ) ) ) return false;
+        }
+        for( uint64_t lo = 0, hi = count; lo < hi; ) {
+            const char *r = records + ( lo + hi ) / 2 * 8*10;
+            uint64_t at = get64( r ), len = get64( r + 8 );
+            if( at + len > footer_size - ( names - p ) ) {
+                return false;
+            }
+            int cmp = std::string( names + at, len ).compare( name );
+            if( !cmp ) {
+                return e = entry{ get64( r + 16 ), get64( r + 24 ), get64( r + 32 ), get64( r + 40 ), 0, 0, get64( r + 48 ), get64( r + 56 ), get64( r + 64 ), 0, 0, get64( r + 72 ), 0, 0, 0, 0, 0, { 0, 0 } }, true;
+            }
+            ( cmp < 0 ? lo : hi ) = cmp < 0 ? ( lo + hi ) / 2 + 1 : ( lo + hi ) / 2;
+        }
+        return false;
+    }
+
+
+    // segment files making up the journal: the journal itself, or the ones listed by its manifest
+    // (its last entry, whose data is only read once its name tells it apart)
+    std::vector<std::string> segments() const {
+        std::vector<std::string> list;
+        std::string name, data, dir = journal.substr( 0, journal.find_last_of( "/\\" ) + 1 );
+        uint64_t datapos = 0, datalen = 0;
+        if( !tail_entry( journal, name, datapos, datalen ) || name != reserved( "segments" ) ) {
+            return list.push_back( journal ), list;
+        }
+        data.resize( datalen );
+        if( !std::ifstream( journal.c_str(), std::ios::binary ).seekg( datapos ).read( &data[0], datalen ) ) {
+            return list.push_back( journal ), list;
+        }
+        for( size_t beg = 0, end; beg < data.size(); beg = end + 1 ) {
+            end = data.find( '\n', beg );
+            end = end == std::string::npos ? data.size() : end;
+            list.push_back( dir + data.substr( beg, end - beg ) );
+        }
+        return list;
+    }
+
+    // picks the file the next entry goes to, rolling over to a new segment when needed
+    std::string target( uint64_t bytes ) const {
+        std::vector<std::string> list = segments();
+        bool plain = list.size() == 1 && list[0] == journal;
+        if( plain && ( !segment_size || file_size( journal ) ) ) {
+            return journal;
+        }
+        uint64_t used = plain ? 0 : file_size( list.back() );
+        if( plain || ( segment_size && used && used + bytes + 8*12 + align > segment_size ) ) {
+            size_t slash = journal.find_last_of( "/\\" ) + 1;
+            std::string stem = journal.substr( slash ), manifest;
+            if( stem.size() > 4 && stem.substr( stem.size() - 4 ) == ".joy" ) {
+                stem.resize( stem.size() - 4 );
+            }
+            char seq[16];
+            snprintf( seq, sizeof(seq), ".%04u.joy", unsigned( plain ? 1 : list.size() + 1 ) );
+            if( plain ) {
+                list.clear();
+            } else if( prealloc ) {
+                trim_file( list.back() );
+            }
+            list.push_back( journal.substr( 0, slash ) + stem + seq );
+            for( auto &file : list ) {
+                manifest += ( manifest.empty() ? "" : "\n" ) + file.substr( slash );
+            }
+            if( !append_file( journal, reserved( "segments" ), manifest.data(), manifest.size(), std::time(0), false ) ) {
+                return std::string();
+            }
+        }
+        return list.back();
+    }
+
+    static bool trim_file( const std::string &file ) {
+#ifdef JOURNEY_POSIX
+        int fd = open_locked( file, O_WRONLY, false );
+        struct stat st;
+        bool ok = fd >= 0 && 0 == fstat( fd, &st ) && 0 == ftruncate( fd, st.st_size );
+        if( fd >= 0 ) close( fd );
+        return ok;
+#else
+        return true;
+#endif
+    }
+
+    // maps a logical journal offset into a segment file and an offset within it
+    const std::string &locate( uint64_t &offset ) const {
+        size_t i = std::upper_bound( bases.begin(), bases.end(), offset ) - bases.begin();
+        i = i ? i - 1 : 0;
+        offset -= bases.empty() ? 0 : bases[i];
+        return files.empty() ? journal : files[i];
+    }
+
+    // 'bulk' appends honor the alignment, i/o and preallocation options; internal ones do not.
+    // 'written' receives the size of the whole entry, fillers included. delta entries and links get the
+    // distance back to the end of the entry they refer to ('refers', within the same file) tagged once
+    // their position is known, under the lock.
+    bool append_file( const std::string &file, const std::string &name, const char *ptr, uint64_t len, uint64_t stamp, bool bulk,
+                      const std::string &tags = std::string(), uint64_t *written = 0, uint64_t refers = 0 ) const {
+        if( bulk && !alignable( align ) ) {
+            return false;
+        }
+#ifdef JOURNEY_POSIX
+        if( bulk && direct_io ) {
+            return append_direct( file, name, ptr, len, stamp, tags, written, refers );
+        }
+        int fd = open_locked( file, O_WRONLY | O_CREAT | O_APPEND, false );
+        struct stat st;
+        bool ok = fd >= 0 && 0 == fstat( fd, &st ) && uint64_t( st.st_size ) >= refers;
+        if( ok ) {
+            std::string head, tail, all = relative_tags( tags, st.st_size, refers );
+            if( !( bulk && varint_framed() && frame3( head, tail, name, len, stamp, all ) ) ) {
+                frame( head, tail, st.st_size, name, len, stamp, bulk ? align : 8, 8, all );
+            }
+            if( bulk ) {
+                preallocate( fd, st, head.size() + len + tail.size() );
+            }
+            struct iovec iov[3] = { { &head[0], head.size() }, { (void *)ptr, len }, { &tail[0], tail.size() } };
+            ok = write_all( fd, iov, 3 );
+            if( written ) *written = head.size() + len + tail.size();
+        }
+        if( fd >= 0 ) ok = ( 0 == close( fd ) ) && ok;
+        return ok;
+#else
+        std::ofstream ofs( file.c_str(), std::ios::binary | std::ios::app | std::ios::ate );
+        uint64_t pos = ofs.good() ? uint64_t(ofs.tellp()) : 0;
+        if( ofs.good() && pos >= refers ) {
+            std::string head, tail, all = relative_tags( tags, pos, refers );
+            if( !( bulk && varint_framed() && frame3( head, tail, name, len, stamp, all ) ) ) {
+                frame( head, tail, pos, name, len, stamp, bulk ? align : 8, 8, all );
+            }
+            ofs.write( &head[0], head.size() );
+            ofs.write( ptr, len );
+            ofs.write( &tail[0], tail.size() );
+            if( written ) *written = head.size() + len + tail.size();
+        }
+        return ofs.good() && pos >= refers;
+#endif
+    }
+
+    static bool alignable( uint64_t boundary ) {
+        return boundary >= 8 && boundary <= uint64_t( max_align ) && !( boundary & ( boundary - 1 ) );
+    }
+
+    static uint64_t pad( uint64_t pos, uint64_t boundary ) {
+        return ( boundary - pos % boundary ) % boundary;
+    }
+
+    static uint64_t swap64( uint64_t v ) {
+        v = ( v & 0x00FF00FF00FF00FFULL ) << 8 | ( v >> 8 & 0x00FF00FF00FF00FFULL );
+        v = ( v & 0x0000FFFF0000FFFFULL ) << 16 | ( v >> 16 & 0x0000FFFF0000FFFFULL );
+        return v << 32 | v >> 32;
+    }
+
+    // checks the magic of an info block, and byte-swaps the block in place if it was written by a host
+    // of the other endianness. tags and footer indexes are little-endian everywhere, so info blocks are
+    // all there is to swap.
+    bool trailer( uint64_t block[5] ) const {
+        if( block[4] == magic_wrong_endian ) {
+            for( int i = 0; i < 5; ++i ) block[i] = swap64( block[i] );
+        }
+        return block[4] == magic_right_endian;
+    }
+
+    // checks an info block that ends at 'pos' (see trailer()), and that the entry it describes fits in
+    // front of it. 'start' receives where the entry starts, and 'namepos'/'datapos' where its blocks do.
+    bool info_block( uint64_t block[5], uint64_t pos, uint64_t &start, uint64_t &namepos, uint64_t &datapos ) const {
+        if( pos < 8*5 || !trailer( block ) || block[3] > pos - 8*5 || block[1] > pos - 8*5 ) {
+            return false;
+        }
+        start = pos - 8*5 - block[3];
+        namepos = start + pad( start, 8 ), datapos = namepos + block[1] + 1 + pad( namepos + block[1] + 1, 8 );
+        return datapos <= pos - 8*5 && block[2] <= pos - 8*5 - datapos;
+    }
+
+    std::string info( uint64_t stamp, uint64_t namelen, uint64_t datalen, uint64_t filelen ) const {
+        uint64_t block[5] = { stamp, namelen, datalen, filelen, magic_right_endian };
+        return std::string( (const char *)block, sizeof(block) );
+    }
+
+    // little-endian integer, from up to 8 bytes
+    static uint64_t get64( const void *ptr, int bytes = 8 ) {
+        const unsigned char *p = (const unsigned char *)ptr;
+        uint64_t v = 0;
+        while( bytes-- ) v = ( v << 8 ) | p[bytes];
+        return v;
+    }
+
+    static void put_varint( std::string &out, uint64_t v ) {
+        for( ; v >= 0x80; v >>= 7 ) out += char( v | 0x80 );
+        out += char( v );
+    }
+
+    static bool get_varint( const char *&p, const char *end, uint64_t &v ) {
+        v = 0;
+        for( int shift = 0; p < end && shift < 64; shift += 7 ) {
+            v |= uint64_t( *p & 0x7f ) << shift;
+            if( !( *p++ & 0x80 ) ) return true;
+        }
+        return false;
+    }
+
+    // tags describe the entry that follows them. they are stored as [varint tag][varint len][value]
+    // records inside the filler in front of that entry, which readers skip (see the format notes above).
+    enum { tag_hash = 1, tag_lz = 2, tag_dict = 3, tag_chunked = 4, tag_delta = 5, tag_patched = 6, tag_crc = 7, tag_tombstone = 8, tag_link = 9, tag_align = 10,
+           tag_sealed = 11 };
+
+    static void put64( std::string &out, uint64_t v ) {
+        for( int i = 0; i < 8; ++i ) out += char( v >> ( i * 8 ) );
+    }
+
+    static void put_tag( std::string &tags, uint64_t tag, uint64_t value ) {
+        put_varint( tags, tag );
+        put_varint( tags, 8 );
+        put64( tags, value );
+    }
+
+    // appends a tombstone for a name, or for every name with that prefix (kind 1 or 2)
+    bool tombstone( const std::string &name, uint64_t kind, uint64_t stamp ) const {
+        std::string tags;
+        put_tag( tags, tag_tombstone, kind );
+        return journal.size() && !name.empty() && name[0] && append_entry( name, "", 0, stamp, tags, false );
+    }
+
+    // whether appends (and compactions) write format 3 entries
+    bool varint_framed() const {
+        return format == 3 && align <= 8 && !direct_io;
+    }
+
+    // fills a buffer out of the csprng of the os (std::random_device, where there is no direct call for it)
+    static void os_random( void *out, size_t len ) {
+        char *p = (char *)out;
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+        arc4random_buf( p, len );
+        len = 0;
+#elif defined(JOURNEY_GETRANDOM)
+        while( len ) {
+            ssize_t n = getrandom( p, len, 0 );
+            if( n < 0 && errno == EINTR ) continue;
+            if( n <= 0 ) break;
+            p += n, len -= n;
+        }
+#endif
+        std::random_device device;
+        for( ; len; ) {
+            unsigned v = device();
+            size_t n = len < sizeof(v) ? len : sizeof(v);
+            memcpy( p, &v, n );
+            p += n, len -= n;
+        }
+    }
+
+    // a fresh nonce for an encrypted entry: 192 bits out of the os csprng, into 'salt' and the returned
+    // word, where bit 1 is set (so it is never 0) and bit 0 tells whether its name is encrypted too
+    static uint64_t nonce_of( bool named, uint64_t salt[2] ) {
+        uint64_t r[3];
+        os_random( r, sizeof(r) );
+        salt[0] = r[1], salt[1] = r[2];
+        return ( r[0] & ~3ull ) | 2 | ( named ? 1 : 0 );
+    }
+
+    // tags an entry with its nonce
+    static void put_nonce( std::string &tags, uint64_t nonce, const uint64_t salt[2] ) {
+        put_varint( tags, tag_sealed );
+        put_varint( tags, 8*3 );
+        put64( tags, nonce );
+        put64( tags, salt[0] );
+        put64( tags, salt[1] );
+    }
+
+    // data blocks are authenticated along with the (plain) name and the stamp of their entry, so they
+    // cannot be passed off as another entry. names are authenticated along with the stamp.
+    static std::string associated( const std::string &name, uint64_t stamp ) {
+        std::string aad = name;
+        put64( aad, stamp );
+        return aad;
+    }
+
+    // encrypts a data block in place, appending its tag. xchacha20-poly1305: chacha20-poly1305 under the
+    // hchacha20() subkey of the key and 'salt', with the rest of the nonce (domain 0 for data, 1 for names)
+    bool seal_data( std::string &data, uint64_t nonce, const uint64_t salt[2], const std::string &name, uint64_t stamp ) const {
+        char tag[16];
+        return chacha20_poly1305( hchacha20( key, salt ), 0, nonce, &data[0], data.size(), tag, true, associated( name, stamp ) ) && ( data.append( tag, 16 ), true );
+    }
+
+    // checks and decrypts the data block of an entry named 'name' as read (if encrypted), dropping its tag
+    bool unseal_data( const entry &e, const std::string &name, std::string &stored ) const {
+        if( !e.sealed ) {
+            return true;
+        }
+        uint64_t len = stored.size() - 16;
+        if( stored.size() < 16 || !chacha20_poly1305( hchacha20( key, e.salt ), 0, e.sealed, &stored[0], len, &stored[ len ], false, associated( name, e.stamp ) ) ) {
+            return false;
+        }
+        return stored.resize( len ), true;
+    }
+
+    // encrypted names are stored as the hex of their ciphertext and tag
+    std::string seal_name( const std::string &name, uint64_t nonce, const uint64_t salt[2], uint64_t stamp ) const {
+        std::string data = name, hex;
+        char tag[16];
+        chacha20_poly1305( hchacha20( key, salt ), 1, nonce, &data[0], data.size(), tag, true, associated( std::string(), stamp ) );
+        data.append( tag, 16 );
+        for( unsigned char c : data ) {
+            hex += "0123456789abcdef"[ c >> 4 ];
+            hex += "0123456789abcdef"[ c & 15 ];
+        }
+        return hex;
+    }
+
+    bool unseal_name( std::string &name, uint64_t nonce, const uint64_t salt[2], uint64_t stamp ) const {
+        auto digit = []( char c ) { return c <= '9' ? c - '0' : c - 'a' + 10; };
+        std::string data;
+        for( size_t i = 0; i + 1 < name.size(); i += 2 ) data += char( digit( name[i] ) << 4 | digit( name[i + 1] ) );
+        uint64_t len = data.size() - 16;
+        if( name.size() % 2 || data.size() <= 16 || !chacha20_poly1305( hchacha20( key, salt ), 1, nonce, &data[0], len, &data[ len ], false, associated( std::string(), stamp ) ) ) {
+            return false;
+        }
+        return name.assign( data, 0, len ), true;
+    }
+
+    // content hash of appended data. keyed when encrypting (out of the keystream), so that hashes stored
+    // in the clear do not tell contents apart.
+    uint64_t content_hash( const void *ptr, size_t len ) const {
+        char seed[8] = {}, tag[16];
+        if( !key.empty() ) chacha20_poly1305( key, 2, 0, seed, 8, tag, true );
+        return hash64( ptr, len, get64( seed ) ) | 1;
+    }
+
+    // the name an entry is stored under: encrypted with its nonce when it was (and the key is known)
+    std::string stored_name( const entry &e, const std::string &name ) const {
+        return e.sealed & 1 && !key.empty() ? seal_name( name, e.sealed, e.salt, e.stamp ) : name;
+    }
+
+    // the name of an entry as stored, decrypted when it was encrypted (and the key is known)
+    std::string plain_name( const entry &e, std::string name ) const {
+        if( e.sealed & 1 && !key.empty() ) unseal_name( name, e.sealed, e.salt, e.stamp );
+        return name;
+    }
+
+    // the tags of an entry appended at 'pos', plus the distance back to the entry ending at 'refers' (if
+    // any): the version a delta entry (one tagged as patched) patches, or else the entry a link shares
+    static std::string relative_tags( const std::string &tags, uint64_t pos, uint64_t refers ) {
+        entry e = entry();
+        std::string out = tags;
+        apply_tags( e, tags );
+        if( refers ) put_tag( out, e.patched ? tag_delta : tag_link, pos - refers + 1 );
+        return out;
+    }
+
+    static std::string tags_of( const entry &e ) {
+        std::string tags;
+        if( e.hash ) put_tag( tags, tag_hash, e.hash );
+        if( e.raw ) put_tag( tags, tag_lz, e.raw );
+        if( e.dict ) put_tag( tags, tag_dict, e.dict );
+        if( e.chunked ) put_tag( tags, tag_chunked, e.chunked );
+        if( e.crc ) put_tag( tags, tag_crc, e.crc );
+        if( e.tombstone ) put_tag( tags, tag_tombstone, e.tombstone );
+        if( e.align ) put_tag( tags, tag_align, e.align );
+        if( e.sealed ) put_nonce( tags, e.sealed, e.salt );
+        return tags;
+    }
+
+    static void apply_tags( entry &e, const std::string &tags ) {
+        const char *p = tags.data(), *end = p + tags.size();
+        for( uint64_t tag, len; get_varint( p, end, tag ) && get_varint( p, end, len ) && len <= uint64_t( end - p ); p += len ) {
+            if( tag == tag_hash && len == 8 ) e.hash = get64( p );
+            if( tag == tag_lz && len == 8 ) e.raw = get64( p );
+            if( tag == tag_dict && len == 8 ) e.dict = get64( p );
+            if( tag == tag_chunked && len == 8 ) e.chunked = get64( p );
+            if( tag == tag_delta && len == 8 ) e.delta = get64( p );
+            if( tag == tag_patched && len == 8 ) e.patched = get64( p );
+            if( tag == tag_crc && len == 8 ) e.crc = get64( p );
+            if( tag == tag_tombstone && len == 8 ) e.tombstone = get64( p );
+            if( tag == tag_link && len == 8 ) e.link = get64( p );
+            if( tag == tag_align && len == 8 ) e.align = get64( p );
+            if( tag == tag_sealed && len == 8*3 ) e.sealed = get64( p ), e.salt[0] = get64( p + 8 ), e.salt[1] = get64( p + 16 );
+        }
+    }
+
+    // a small lz77 codec. the stream is a run of [token][literals][offset][match] sequences (lz4-like):
+    // the token holds 4-bit literal and match lengths, extended by 255-valued bytes, and offsets are 16
+    // bits. the last sequence has literals only. matches may reach back into a dictionary, which then
+    // behaves as if it preceded the content.
+    static std::string lz_pack( const char *src, uint64_t len, const std::string &dict = std::string() ) {
+        std::string joined;
+        uint64_t start = dict.size();
+        if( start ) {
+            joined = dict + std::string( src, len );
+            src = joined.data(), len += start;
+        }
+        const unsigned char *p = (const unsigned char *)src;
+        std::vector<uint64_t> table( 1 << 14, 0 ); // last position + 1 of every hashed 4-byte prefix
+        for( uint64_t i = 0; i + 4 <= start; ++i ) {
+            table[ uint32_t( get64( p + i, 4 ) * 2654435761u ) >> 18 ] = i + 1;
+        }
+        std::string out;
+        out.reserve( len / 2 + 16 );
+        auto more = [&]( uint64_t n ) {
+            for( ; n >= 255; n -= 255 ) out += char( 255 );
+            out += char( n );
+        };
+        auto sequence = [&]( uint64_t from, uint64_t lit, uint64_t match, uint64_t dist ) {
+            uint64_t m = match ? match - 4 : 0;
+            out += char( ( lit < 15 ? lit : 15 ) << 4 | ( m < 15 ? m : 15 ) );
+            if( lit >= 15 ) more( lit - 15 );
+            out.append( src + from, lit );
+            if( match ) {
+                out += char( dist ), out += char( dist >> 8 );
+                if( m >= 15 ) more( m - 15 );
+            }
+        };
+        uint64_t anchor = start;
+        for( uint64_t i = start; i + 8 <= len; ) {
+            uint64_t v = get64( p + i, 4 ), &slot = table[ uint32_t( v * 2654435761u ) >> 18 ], at = slot - 1;
+            slot = i + 1;
+            if( at < i && i - at <= 65535 && get64( p + at, 4 ) == v ) {
+                uint64_t match = 4;
+                while( i + match < len && p[ at + match ] == p[ i + match ] ) ++match;
+                sequence( anchor, i - anchor, match, i - at );
+                anchor = i += match;
+            } else {
+                ++i;
+            }
+        }
+        sequence( anchor, len - anchor, 0, 0 );
+        return out;
+    }
+
+    static bool lz_unpack( const char *src, uint64_t len, char *dst, uint64_t raw, const std::string &dict = std::string() ) {
+        const unsigned char *p = (const unsigned char *)src, *end = p + len;
+        uint64_t o = 0, back = dict.size();
+        auto more = [&]( uint64_t &n ) {
+            for( unsigned char b = 255; b == 255; n += b ) {
+                if( p == end ) return false;
+                b = *p++;
+            }
+            return true;
+        };
+        while( p < end ) {
+            uint64_t lit = *p >> 4, match = *p++ & 15, dist;
+            if( ( lit == 15 && !more( lit ) ) || lit > uint64_t( end - p ) || lit > raw - o ) {
+                return false;
+            }
+            memcpy( dst + o, p, lit );
+            p += lit, o += lit;
+            if( p == end ) {
+                break;
+            }
+            if( end - p < 2 ) {
+                return false;
+            }
+            dist = p[0] | p[1] << 8, p += 2;
+            if( ( match == 15 && !more( match ) ) || !dist || dist > o + back || ( match += 4 ) > raw - o ) {
+                return false;
+            }
+            for( ; match--; ++o ) dst[o] = dist > o ? dict[ back + o - dist ] : dst[o - dist];
+        }
+        return o == raw;
+    }
+
+    // packs some content, unless that would not shrink it by 1/8 at least. contents larger than 4 KiB
+    // are sampled first (a few 1 KiB slices spread over them), so incompressible ones are cheap to skip.
+    static std::string pack( const char *ptr, uint64_t len, const std::string &dict ) {
+        if( len < ( dict.empty() ? 64 : 16 ) ) {
+            return std::string();
+        }
+        uint64_t in = 0, out = 0, step = len / 4;
+        for( uint64_t at = 0; len > 4096 && at + 1024 <= len && in < 4096; at += step ) {
+            in += 1024, out += lz_pack( ptr + at, 1024, dict ).size();
+        }
+        std::string packed = out <= in - in / 8 ? lz_pack( ptr, len, dict ) : std::string();
+        return packed.size() <= len - len / 8 ? packed : std::string();
+    }
+
+    // records a dictionary or a chunk, if that is what an entry is. the first one seen of each id wins.
+    static bool add_part( std::map<std::string, entry> &parts, const std::string &name, const entry &e ) {
+        bool part = !name.compare( 0, 12, reserved( "dictionary:" ) ) || !name.compare( 0, 7, reserved( "chunk:" ) );
+        return part && parts.insert( std::make_pair( name, e ) ).second;
+    }
+
+    uint64_t dictionary_limit() const {
+        return dictionary_size < ( 32 << 10 ) ? dictionary_size : ( 32 << 10 );
+    }
+
+    // contents of a dictionary, as loaded by load() or found in the footer index (empty if missing)
+    const std::string &dictionary( uint64_t id ) const {
+        static const std::string none;
+        if( !id ) {
+            return none;
+        }
+        std::lock_guard<std::mutex> lock( cache_mutex );
+        auto cached = dict_cache.find( id );
+        if( cached != dict_cache.end() ) {
+            return cached->second;
+        }
+        std::string &dict = dict_cache[ id ], name = dict_name( id );
+        auto found = parts.find( name );
+        entry e;
+        if( found != parts.end() ? ( e = found->second, true ) : find( name, e ) ) {
+            uint64_t offset = e.offset;
+            const std::string &file = locate( offset );
+            dict.resize( e.size );
+            if( !std::ifstream( file.c_str(), std::ios::binary ).seekg( offset ).read( &dict[0], e.size ) || !unseal_data( e, name, dict )
+                || ( hash64( dict.data(), dict.size() ) | 1 ) != id ) {
+                dict.clear();
+            }
+        }
+        return dict;
+    }
+
+    // reads data.size() bytes from some segments, at a logical offset
+    static bool read_at( const std::vector<std::string> &list, const std::vector<uint64_t> &offsets, uint64_t from, std::string &data ) {
+        size_t i = std::upper_bound( offsets.begin(), offsets.end(), from ) - offsets.begin() - 1;
+        return !!std::ifstream( list[i].c_str(), std::ios::binary ).seekg( from - offsets[i] ).read( &data[0], data.size() );
+    }
+
+    // reads back the entry that ends at a logical offset of some segments, tags (and its name, if asked) included
+    bool entry_at( const std::vector<std::string> &list, const std::vector<uint64_t> &offsets, uint64_t end, entry &e, std::string *name = 0 ) const {
+        size_t i = std::upper_bound( offsets.begin(), offsets.end(), end - 1 ) - offsets.begin() - 1;
+        uint64_t base = offsets[i], pos = end - base, block[5], filler[5], start;
+        std::ifstream ifs( list[i].c_str(), std::ios::binary );
+        std::string tags;
+        if( end && trailer3( ifs, pos, block[0], block[1], block[2], start, tags ) ) {
+            e = entry{ base + start + block[1], block[2], block[0], 0, base + start, end, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, { 0, 0 } };
+            if( name ) {
+                name->resize( block[1] );
+                ifs.seekg( start ).read( &(*name)[0], block[1] );
+            }
+            return apply_tags( e, tags ), ifs.good();
+        }
+        if( !end || pos < 8*5 || !ifs.seekg( pos - 8*5 ).read( (char *)block, sizeof(block) ) ) {
+            return false;
+        }
+        if( !trailer( block ) || !block[1] || block[3] > pos - 8*5 ) {
+            return false;
+        }
+        start = pos - 8*5 - block[3];
+        uint64_t namepos = start + pad( start, 8 ), datapos = namepos + block[1] + 1 + pad( namepos + block[1] + 1, 8 );
+        e = entry{ base + datapos, block[2], block[0], 0, base + start, end, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, { 0, 0 } };
+        if( name ) {
+            name->resize( block[1] );
+            if( !ifs.seekg( namepos ).read( &(*name)[0], block[1] ) ) return false;
+        }
+        if( start >= 8*5 && ifs.seekg( start - 8*5 ).read( (char *)filler, sizeof(filler) ) ) {
+            if( trailer( filler ) && !filler[1] && filler[3] <= start - 8*5 ) {
+                uint64_t at = start - 8*5 - filler[3], data = at + pad( at, 8 ) + 8;
+                if( ifs.seekg( data ) && read_tags( ifs, filler[2], tags ) ) {
+                    apply_tags( e, tags );
+                }
+                e.begin = base + at;
+            }
+        }
+        return true;
+    }
+
+    bool entry_at( uint64_t end, entry &e, std::string *name = 0 ) const {
+        return files.empty() ? entry_at( std::vector<std::string>( 1, journal ), std::vector<uint64_t>( 1, 0 ), end, e, name ) : entry_at( files, bases, end, e, name );
+    }
+
+    // number of deltas in front of the full version of an entry
+    unsigned chain_of( entry e ) const {
+        unsigned n = 0;
+        while( e.delta && n <= delta_chain && entry_at( e.begin + 1 - e.delta, e ) ) ++n;
+        return n;
+    }
+
+    // reads the content of an entry named 'name' from some segments, given at their logical offsets.
+    // the dictionaries and chunks it needs are looked up in 'parts'.
+    bool fetch( const std::vector<std::string> &list, const std::vector<uint64_t> &offsets, const std::map<std::string, entry> &parts,
+                const entry &e, const std::string &name, std::string &out, std::map<uint64_t, std::string> &cache ) const {
+        std::string stored( e.size, '\0' ), plain;
+        if( !read_at( list, offsets, e.offset, stored ) || !unseal_data( e, name, stored ) ) {
+            return false;
+        }
+        if( e.raw ) {
+            auto found = parts.find( dict_name( e.dict ) );
+            if( e.dict && !cache.count( e.dict ) && found != parts.end() ) {
+                cache[ e.dict ].resize( found->second.size );
+                if( !read_at( list, offsets, found->second.offset, cache[ e.dict ] ) || !unseal_data( found->second, found->first, cache[ e.dict ] ) ) {
+                    cache[ e.dict ].clear();
+                }
+            }
+            plain.resize( e.raw );
+            if( !lz_unpack( stored.data(), stored.size(), &plain[0], e.raw, cache[ e.dict ] ) ) {
+                return false;
+            }
+            stored.swap( plain );
+        }
+        if( e.chunked ) {
+            out.clear();
+            for( const char *p = stored.data(), *end = p + stored.size(); p + 16 <= end; p += 16 ) {
+                auto found = parts.find( chunk_name( get64( p ) ) );
+                if( found == parts.end() || !fetch( list, offsets, parts, found->second, found->first, plain, cache ) || plain.size() != get64( p + 8 ) ) {
+                    return false;
+                }
+                out += plain;
+            }
+            return out.size() == e.chunked;
+        }
+        if( e.delta ) {
+            entry base;
+            std::string stored_as;
+            if( !entry_at( list, offsets, e.begin + 1 - e.delta, base, &stored_as ) || !fetch( list, offsets, parts, base, plain_name( base, stored_as ), plain, cache ) ) {
+                return false;
+            }
+            out.resize( e.patched );
+            return apply_delta( plain, stored, &out[0], e.patched );
+        }
+        return out.swap( stored ), true;
+    }
+
+    // appends an entry (packed with the active dictionary, if 'packable' and compress are set) to the
+    // current segment, and tracks its bytes. 'refers' is the end of the entry a delta entry (or a link)
+    // refers to.
+    bool append_entry( const std::string &name, const char *ptr, uint64_t len, uint64_t stamp, std::string tags, bool packable,
+                       uint64_t refers = 0 ) const {
+        std::string none;
+        const std::string &dict = packable && compress && active ? dictionary( active ) : none;
+        std::string packed = packable && compress ? pack( ptr, len, dict ) : std::string();
+        if( !packed.empty() ) {
+            put_tag( tags, tag_lz, len );
+            if( !dict.empty() ) put_tag( tags, tag_dict, active );
+            ptr = packed.data(), len = packed.size();
+        }
+        // encrypted after packing, and checksummed as stored. reserved names are never encrypted.
+        std::string sealed, stored_name = name;
+        if( !key.empty() ) {
+            uint64_t salt[2], nonce = nonce_of( encrypt_names && name[0], salt );
+            sealed.assign( ptr, len );
+            if( !seal_data( sealed, nonce, salt, name, stamp ) ) {
+                return false;
+            }
+            if( nonce & 1 ) stored_name = seal_name( name, nonce, salt, stamp );
+            put_nonce( tags, nonce, salt );
+            ptr = sealed.data(), len = sealed.size();
+        }
+        if( checksum ) {
+            put_tag( tags, tag_crc, crc32c( ptr, len ) | 1ull << 32 );
+        }
+        if( align > 8 ) {
+            put_tag( tags, tag_align, align );
+        }
+        std::string file = target( stored_name.size() + len + tags.size() );
+        uint64_t written = 0;
+        if( file.empty() || !append_file( file, stored_name, ptr, len, stamp, true, tags, &written, refers ) ) {
+            return false;
+        }
+        auto found = appended.find( name );
+        auto loaded = toc.find( name );
+        uint64_t dead = found != appended.end() ? found->second : loaded == toc.end() ? 0 : loaded->second.packed ? loaded->second.size : loaded->second.end - loaded->second.begin;
+        appended[ name ] = written;
+        bytes_total += written;
+        bytes_live += written - dead;
+        return true;
+    }
+
+    static uint64_t content_size( const entry &e ) {
+        return e.patched ? e.patched : e.chunked ? e.chunked : e.raw ? e.raw : e.sealed && e.size >= 16 ? e.size - 16 : e.size;
+    }
+
+    // finds a reserved entry (a dictionary or a chunk), as loaded by load() or in the footer index
+    bool part( const std::string &name, entry &e ) const {
+        auto found = parts.find( name );
+        return found != parts.end() ? ( e = found->second, true ) : find( name, e );
+    }
+
+    // reads the content of an entry named 'name' into 'out', which holds content_size() bytes
+    bool read_entry( const entry &e, const std::string &name, char *out ) const {
+        uint64_t offset = e.offset;
+        const std::string &file = locate( offset );
+        bool staged = e.raw || e.chunked || e.delta || e.sealed;
+        std::string stored( staged ? e.size : 0, '\0' );
+        char *dst = staged ? &stored[0] : out;
+#ifdef JOURNEY_POSIX
+        if( direct_io ) {
+            if( !read_direct( file, dst, offset, e.size ) ) {
+                return false;
+            }
+        } else
+#endif
+        if( !std::ifstream( file.c_str(), std::ios::binary ).seekg( offset ).read( dst, e.size ) ) {
+            return false;
+        }
+        bool checked = false;
+        if( e.crc && verify == verify_first ) {
+            std::lock_guard<std::mutex> lock( cache_mutex );
+            checked = verified.count( e.offset ) != 0;
+        }
+        if( e.crc && verify != verify_never && !checked ) {
+            if( ( crc32c( dst, e.size ) | 1ull << 32 ) != e.crc ) {
+                return false;
+            }
+            std::lock_guard<std::mutex> lock( cache_mutex );
+            verified.insert( e.offset );
+        }
+        if( !unseal_data( e, name, stored ) ) {
+            return false;
+        }
+        if( e.delta ) {
+            entry prev;
+            std::string base, patch( e.raw, '\0' ), stored_as;
+            if( !entry_at( e.begin + 1 - e.delta, prev, &stored_as ) || ( e.raw && !decode( e, stored, &patch[0] ) ) ) {
+                return false;
+            }
+            base.resize( content_size( prev ) );
+            return read_entry( prev, plain_name( prev, stored_as ), &base[0] ) && apply_delta( base, e.raw ? patch : stored, out, e.patched );
+        }
+        if( !e.chunked ) {
+            return decode( e, stored, out );
+        }
+        uint64_t pos = 0;
+        for( const char *p = stored.data(), *end = p + stored.size(); p + 16 <= end; p += 16 ) {
+            entry chunk;
+            uint64_t size = get64( p + 8 );
+            std::string id = chunk_name( get64( p ) );
+            if( size > e.chunked - pos || !part( id, chunk ) || content_size( chunk ) != size || !read_entry( chunk, id, out + pos ) ) {
+                return false;
+            }
+            pos += size;
+        }
+        return pos == e.chunked;
+    }
+
+    // content-defined chunking: a gear rolling hash cuts wherever its top log2(average) bits are zero,
+    // for chunks of 'average' bytes on average (a quarter to 4 times that). cuts only depend on the
+    // nearby bytes, so they survive insertions and deletions elsewhere. returns the end of every chunk.
+    static std::vector<uint64_t> cut( const char *ptr, uint64_t len, uint64_t average ) {
+        static const std::vector<uint64_t> gear = [] {
+            std::vector<uint64_t> table( 256 );
+            uint64_t x = 0;
+            for( auto &v : table ) {
+                uint64_t z = ( x += 0x9E3779B97F4A7C15ULL );
+                z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+                z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+                v = z ^ ( z >> 31 );
+            }
+            return table;
+        }();
+        int bits = 0;
+        while( ( 2ull << bits ) <= average ) ++bits;
+        uint64_t mask = bits ? ~0ull << ( 64 - bits ) : 0;
+        std::vector<uint64_t> ends;
+        for( uint64_t start = 0, i; start < len; start = i ) {
+            uint64_t h = 0, max = len - start > average * 4 ? start + average * 4 : len;
+            for( i = start + average / 4 < max ? start + average / 4 : max; i < max; ) {
+                h = ( h << 1 ) + gear[ (unsigned char)ptr[i++] ];
+                if( !( h & mask ) ) break;
+            }
+            ends.push_back( i );
+        }
+        return ends;
+    }
+
+    // binary deltas: a run of [varint n << 1][n bytes] inserts and [varint n << 1 | 1][varint at] copies
+    // of base bytes [at, at + n). copies are found through the 16-byte blocks of the base, and grown
+    // both ways from there.
+    static std::string make_delta( const std::string &base, const char *ptr, uint64_t len ) {
+        enum { block = 16 };
+        auto key = []( const char *p ) {
+            return get64( p ) * 0x9E3779B97F4A7C15ULL ^ get64( p + 8 );
+        };
+        std::unordered_map<uint64_t, uint64_t> blocks( base.size() / block + 1 );
+        for( uint64_t at = 0; at + block <= base.size(); at += block ) {
+            blocks.insert( std::make_pair( key( &base[at] ), at ) );
+        }
+        std::string out;
+        uint64_t lit = 0;
+        auto insert = [&]( uint64_t end ) {
+            if( end > lit ) put_varint( out, ( end - lit ) << 1 ), out.append( ptr + lit, end - lit );
+        };
+        for( uint64_t i = 0; i + block <= len; ) {
+            auto found = blocks.find( key( ptr + i ) );
+            if( found == blocks.end() || memcmp( &base[ found->second ], ptr + i, block ) ) {
+                ++i;
+                continue;
+            }
+            uint64_t at = found->second, n = block;
+            while( i > lit && at && base[ at - 1 ] == ptr[ i - 1 ] ) --i, --at, ++n;
+            while( i + n < len && at + n < base.size() && base[ at + n ] == ptr[ i + n ] ) ++n;
+            insert( i );
+            put_varint( out, n << 1 | 1 );
+            put_varint( out, at );
+            lit = i += n;
+        }
+        insert( len );
+        return out;
+    }
+
+    static bool apply_delta( const std::string &base, const std::string &delta, char *out, uint64_t size ) {
+        const char *p = delta.data(), *end = p + delta.size();
+        uint64_t o = 0;
+        for( uint64_t op, at, n; p < end; o += n ) {
+            if( !get_varint( p, end, op ) || ( n = op >> 1 ) > size - o ) {
+                return false;
+            }
+            if( op & 1 ) {
+                if( !get_varint( p, end, at ) || at > base.size() || n > base.size() - at ) {
+                    return false;
+                }
+                memcpy( out + o, base.data() + at, n );
+            } else {
+                if( n > uint64_t( end - p ) ) {
+                    return false;
+                }
+                memcpy( out + o, p, n );
+                p += n;
+            }
+        }
+        return o == size;
+    }
+
+    static std::string chunk_name( uint64_t id ) {
+        char hex[17];
+        snprintf( hex, sizeof(hex), "%016llx", (unsigned long long)id );
+        return reserved( "chunk:" ) + hex;
+    }
+
+    // turns the bytes stored for an entry into its content
+    bool decode( const entry &e, const std::string &stored, char *out ) const {
+        if( !e.raw ) {
+            // only staged when encrypted, and decrypted by now
+            return !e.sealed || stored.empty() || ( memcpy( out, stored.data(), stored.size() ), true );
+        }
+        return lz_unpack( stored.data(), stored.size(), out, e.raw, dictionary( e.dict ) );
+    }
+
+    // dictionaries are stored as reserved entries named after their id, which is their content hash
+    enum { dict_samples = 1 << 20, dict_entry_size = 64 << 10, stage_size = 256 << 20 };
+
+    static std::string dict_name( uint64_t id ) {
+        char hex[17];
+        snprintf( hex, sizeof(hex), "%016llx", (unsigned long long)id );
+        return reserved( "dictionary:" ) + hex;
+    }
+
+    // trains a dictionary out of some samples. runs of bytes whose 8-byte substrings show up in several
+    // samples are ranked by how many bytes they would save, and the best ones not already covered are
+    // concatenated, best last (closest to the data).
+    static std::string train_dictionary( const std::vector<std::string> &samples, uint64_t size ) {
+        std::unordered_map< uint64_t, std::pair<uint32_t, uint32_t> > seen; // 8-byte substring: samples, last sample
+        for( uint32_t k = 0; k < samples.size(); ++k ) {
+            for( uint64_t i = 0; i + 8 <= samples[k].size(); ++i ) {
+                auto &df = seen[ get64( &samples[k][i] ) ];
+                if( df.second != k + 1 ) df.first++, df.second = k + 1;
+            }
+        }
+        std::map< std::string, uint64_t > runs;
+        for( auto &sample : samples ) {
+            for( uint64_t i = 0, from = 0, score = 0; i + 8 <= sample.size() + 1; ++i ) {
+                uint32_t df = i + 8 <= sample.size() ? seen[ get64( &sample[i] ) ].first : 0;
+                if( df > 1 && i - from < 256 ) {
+                    score += df - 1;
+                    continue;
+                }
+                if( score ) {
+                    uint64_t &best = runs[ sample.substr( from, i - from + 7 ) ];
+                    best = best > score ? best : score;
+                }
+                from = i + ( df <= 1 ), score = df > 1 ? df - 1 : 0;
+            }
+        }
+        std::vector< std::pair<uint64_t, const std::string *> > ranked;
+        for( auto &it : runs ) {
+            ranked.push_back( std::make_pair( it.second, &it.first ) );
+        }
+        std::sort( ranked.begin(), ranked.end(), []( const std::pair<uint64_t, const std::string *> &a, const std::pair<uint64_t, const std::string *> &b ) {
+            return a.first != b.first ? a.first > b.first : *a.second < *b.second;
+        } );
+        std::string dict;
+        for( auto &it : ranked ) {
+            if( dict.size() + it.second->size() <= size && dict.find( *it.second ) == std::string::npos ) dict = *it.second + dict;
+        }
+        return dict;
+    }
+
+    static bool read_tags( std::istream &is, uint64_t datalen, std::string &tags ) {
+        char prefix[10];
+        uint64_t got = datalen < 10 ? datalen : 10, taglen;
+        const char *p = prefix;
+        if( !is.read( prefix, got ) || !get_varint( p, prefix + got, taglen ) || !taglen || taglen > datalen - ( p - prefix ) ) {
+            return false;
+        }
+        uint64_t have = prefix + got - p < int64_t( taglen ) ? prefix + got - p : taglen;
+        tags.assign( p, have );
+        tags.resize( taglen );
+        return taglen == have || is.read( &tags[ have ], taglen - have );
+    }
+
+    // a nameless entry spanning [pos, end), holding a varint-prefixed tag block (if any). end must be
+    // 8-aligned and leave room for the entry.
+    std::string filler( uint64_t pos, uint64_t end, const std::string &tags = std::string() ) const {
+        uint64_t datapos = pos + pad(pos, 8) + 8;
+        std::string blob( end - 8*5 - pos, '\0' );
+        if( !tags.empty() ) {
+            std::string block;
+            put_varint( block, tags.size() );
+            blob.replace( datapos - pos, block.size() + tags.size(), block + tags );
+        }
+        return blob + info( 0, 0, end - 8*5 - datapos, end - 8*5 - pos );
+    }
+
+    // size of the smallest filler able to hold 'tags'
+    static uint64_t filler_size( const std::string &tags ) {
+        uint64_t bytes = tags.empty() ? 0 : tags.size() + 10;
+        return 8*6 + bytes + pad( bytes, 8 );
+    }
+
+    // builds everything that surrounds the data block of an entry appended at 'pos': a filler (if
+    // needed to hold tags or to align the data block), the padded name and the padded info block.
+    // the tail is then extended with another filler so the entry ends on a 'tail_align' boundary.
+    void frame( std::string &head, std::string &tail, uint64_t pos, const std::string &name, uint64_t datalen,
+                uint64_t stamp, uint64_t data_align, uint64_t tail_align, const std::string &tags = std::string() ) const {
+        uint64_t namelen = name.size(), nameblk = namelen + 1 + pad(namelen + 1, 8);
+        head.clear();
+        if( !tags.empty() || pad( pos + pad(pos, 8) + nameblk, data_align ) ) {
+            uint64_t end = pos + pad(pos, 8) + filler_size( tags ) + nameblk;
+            end += pad(end, data_align);
+            head = filler( pos, end - nameblk, tags );
+            pos = end - nameblk;
+        }
+        uint64_t start = pos;
+        head.append( pad(pos, 8), '\0' );
+        head.append( name.c_str(), namelen + 1 );
+        head.append( pad(namelen + 1, 8), '\0' );
+        pos += pad(pos, 8) + nameblk + datalen;
+        tail.assign( pad(pos, 8), '\0' );
+        pos += pad(pos, 8);
+        tail += info( stamp, namelen, datalen, pos - start );
+        pos += 8*5;
+        if( pad(pos, tail_align) ) {
+            uint64_t end = pos + 8*6;
+            end += pad(end, tail_align);
+            tail += filler( pos, end );
+        }
+    }
+
+    // format 3 entries are [name][data][trailer], unpadded. the trailer is [varint stamp][varint name
+    // length][varint data length][tags], then the 8-bit size of all that and the 'joy3' magic. returns
+    // false when the tags do not fit.
+    static bool frame3( std::string &head, std::string &tail, const std::string &name, uint64_t datalen, uint64_t stamp, const std::string &tags ) {
+        tail.clear();
+        put_varint( tail, stamp );
+        put_varint( tail, name.size() );
+        put_varint( tail, datalen );
+        tail += tags;
+        if( tail.size() > 255 ) {
+            return false;
+        }
+        tail += char( tail.size() );
+        tail.append( "joy3", 4 );
+        head = name;
+        return true;
+    }
+
+    // reads the format 3 trailer ending at 'pos', if that is what ends there
+    static bool trailer3( std::istream &is, uint64_t pos, uint64_t &stamp, uint64_t &namelen, uint64_t &datalen, uint64_t &start, std::string &tags ) {
+        char end[5], block[255];
+        if( pos < 5 || !is.seekg( pos - 5 ).read( end, 5 ) || memcmp( end + 1, "joy3", 4 ) ) {
+            return false;
+        }
+        uint64_t size = (unsigned char)end[0];
+        const char *p = block, *stop = block + size;
+        if( size + 5 > pos || !is.seekg( pos - 5 - size ).read( block, size ) ) {
+            return false;
+        }
+        if( !get_varint( p, stop, stamp ) || !get_varint( p, stop, namelen ) || !get_varint( p, stop, datalen ) ) {
+            return false;
+        }
+        if( !namelen || namelen > pos - 5 - size || datalen > pos - 5 - size - namelen ) {
+            return false;
+        }
+        tags.assign( p, stop );
+        start = pos - 5 - size - namelen - datalen;
+        return true;
+    }
+
+    // whether a valid entry ends at 'pos' of a stream, and where it starts: a trailer whose lengths fit in
+    // front of it and, in format 2, whose name is terminated where the info block says
+    bool ends_entry( std::istream &is, uint64_t pos, uint64_t &start ) const {
+        uint64_t block[5], stamp, namelen, datalen;
+        std::string tags;
+        char zero = 1;
+        is.clear();
+        if( trailer3( is, pos, stamp, namelen, datalen, start, tags ) ) {
+            return true;
+        }
+        is.clear();
+        uint64_t namepos, datapos;
+        if( pos < 8*5 || !is.seekg( pos - 8*5 ).read( (char *)block, sizeof(block) ) || !info_block( block, pos, start, namepos, datapos ) ) {
+            return is.clear(), false;
+        }
+        bool ok = is.seekg( namepos + block[1] ).get( zero ) && !zero;
+        return is.clear(), ok;
+    }
+
+    // offsets of a buffer where a magic may start: 'jo' ('journey1', 'joy3') or '1y' (a byte-swapped
+    // 'journey1'), compared 16 bytes at a time with sse2 where available
+    static void magic_candidates( const char *p, size_t len, std::vector<size_t> &out ) {
+        size_t i = 0;
+        out.clear();
+#ifdef JOURNEY_SSE42
+        const __m128i j = _mm_set1_epi8( 'j' ), o = _mm_set1_epi8( 'o' ), one = _mm_set1_epi8( '1' ), y = _mm_set1_epi8( 'y' );
+        for( ; i + 17 <= len; i += 16 ) {
+            __m128i a = _mm_loadu_si128( (const __m128i *)( p + i ) ), b = _mm_loadu_si128( (const __m128i *)( p + i + 1 ) );
+            __m128i hit = _mm_or_si128( _mm_and_si128( _mm_cmpeq_epi8( a, j ), _mm_cmpeq_epi8( b, o ) ),
+                                        _mm_and_si128( _mm_cmpeq_epi8( a, one ), _mm_cmpeq_epi8( b, y ) ) );
+            for( unsigned mask = unsigned( _mm_movemask_epi8( hit ) ); mask; mask &= mask - 1 ) {
+                out.push_back( i + __builtin_ctz( mask ) );
+            }
+        }
+#endif
+        for( ; i + 1 < len; ++i ) {
+            if( ( p[i] == 'j' && p[i + 1] == 'o' ) || ( p[i] == '1' && p[i + 1] == 'y' ) ) out.push_back( i );
+        }
+    }
+
+    // whether the data block of the entry ending at 'end' of a file matches its crc, if it has one
+    bool intact( std::istream &is, const std::string &file, uint64_t end ) const {
+        entry e;
+        if( !entry_at( std::vector<std::string>( 1, file ), std::vector<uint64_t>( 1, 0 ), end, e ) ) {
+            return false;
+        }
+        std::vector<char> buf( e.crc ? bounce_size : 0 );
+        uint32_t crc = 0;
+        is.clear();
+        is.seekg( e.offset );
+        for( uint64_t left = e.crc ? e.size : 0, n; left; left -= n ) {
+            n = left < buf.size() ? left : buf.size();
+            if( !is.read( &buf[0], n ) ) {
+                return is.clear(), false;
+            }
+            crc = crc32c( &buf[0], n, crc );
+        }
+        return !e.crc || ( crc | 1ull << 32 ) == e.crc;
+    }
+
+    // finds where to resume a backward scan of a file that failed at 'pos' (0 if nowhere): the nearest
+    // position before it where an intact entry ends, and from where the 8 entries before it (or all of
+    // them, back to the start of the file) check out too. at the 'tail' of a file (a torn append), one
+    // of them is enough, as the journal may follow foreign data. the tail is searched backwards for
+    // magics a window at a time, so a torn tail costs about as much to skip as its own size. elsewhere
+    // (ie, appends that followed an unrepaired torn tail) only the window right before 'pos' is, so
+    // that foreign data in front of a journal is not searched through on every load().
+    uint64_t resync( std::istream &is, const std::string &file, uint64_t pos, bool tail ) const {
+        std::vector<char> window( resync_window + 8 );
+        std::vector<size_t> found;
+        for( uint64_t hi = pos; hi > 0; ) {
+            uint64_t lo = hi > uint64_t( resync_window ) ? hi - resync_window : 0, len = hi - lo + ( pos - hi < 8 ? pos - hi : 8 );
+            is.clear();
+            if( !is.seekg( lo ).read( &window[0], len ) ) {
+                return is.clear(), 0;
+            }
+            magic_candidates( &window[0], len, found );
+            for( auto it = found.rbegin(); it != found.rend(); ++it ) {
+                uint64_t at = lo + *it, end = 0, start, v;
+                if( *it >= hi - lo ) {
+                    continue; // seen with the previous window
+                }
+                if( len - *it >= 8 && ( memcpy( &v, &window[*it], 8 ), v == magic_right_endian || v == magic_wrong_endian ) ) end = at + 8;
+                if( len - *it >= 4 && !memcmp( &window[*it], "joy3", 4 ) ) end = at + 4;
+                if( !end || end >= pos || !ends_entry( is, end, start ) ) {
+                    continue;
+                }
+                unsigned depth = 1;
+                while( depth < 8 && start > 0 && ends_entry( is, start, start ) ) ++depth;
+                if( ( depth == 8 || start == 0 || ( tail && depth > 1 ) ) && intact( is, file, end ) ) {
+                    return end;
+                }
+            }
+            if( !tail ) {
+                break;
+            }
+            hi = lo;
+        }
+        return 0;
+    }
+
+    enum { bounce_size = 1 << 20, chunk_size = 64 << 20, resync_window = 1 << 20 };
+
+    // minimal positional file i/o: posix descriptors, or stdio streams elsewhere
+    struct handle {
+#ifdef JOURNEY_POSIX
+        int fd = -1;
+#else
+        FILE *fp = 0;
+#endif
+        handle()
+        {}
+        ~handle() {
+            close();
+        }
+        handle( const handle & ) = delete;
+        handle &operator=( const handle & ) = delete;
+
+        bool open( const std::string &path, bool writable ) {
+#ifdef JOURNEY_POSIX
+            fd = ::open( path.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644 );
+#else
+            fp = fopen( path.c_str(), writable ? "r+b" : "rb" );
+            fp = fp || !writable ? fp : fopen( path.c_str(), "w+b" );
+#endif
+            return is_open();
+        }
+        bool is_open() const {
+#ifdef JOURNEY_POSIX
+            return fd >= 0;
+#else
+            return fp != 0;
+#endif
+        }
+        bool close() {
+#ifdef JOURNEY_POSIX
+            bool ok = fd < 0 || 0 == ::close( fd );
+            fd = -1;
+#else
+            bool ok = !fp || 0 == fclose( fp );
+            fp = 0;
+#endif
+            return ok;
+        }
+        uint64_t size() const {
+#ifdef JOURNEY_POSIX
+            struct stat st;
+            return 0 == fstat( fd, &st ) ? uint64_t( st.st_size ) : 0;
+#else
+            return seek( ~0ull ) ? uint64_t( _ftelli64( fp ) ) : 0;
+#endif
+        }
+        bool read( uint64_t at, void *dst, uint64_t len ) const {
+#ifdef JOURNEY_POSIX
+            for( ssize_t n; len; at += n, len -= n, dst = (char *)dst + n ) {
+                n = pread( fd, dst, len, at );
+                if( n < 0 && errno == EINTR ) n = 0;
+                else if( n <= 0 ) return false;
+            }
+            return true;
+#else
+            return seek( at ) && fread( dst, 1, len, fp ) == len;
+#endif
+        }
+        bool write( uint64_t at, const void *src, uint64_t len ) {
+#ifdef JOURNEY_POSIX
+            for( ssize_t n; len; at += n, len -= n, src = (const char *)src + n ) {
+                n = pwrite( fd, src, len, at );
+                if( n < 0 && errno == EINTR ) n = 0;
+                else if( n <= 0 ) return false;
+            }
+            return true;
+#else
+            return seek( at ) && fwrite( src, 1, len, fp ) == len;
+#endif
+        }
+        bool sync() {
+#ifdef JOURNEY_POSIX
+            return 0 == fsync( fd );
+#else
+            return 0 == fflush( fp );
+#endif
+        }
+        // copies [at, at + len) from another file into this one at 'to', inside the kernel when possible
+        bool copy( uint64_t to, const handle &src, uint64_t at, uint64_t len, std::vector<char> &buf ) {
+#if defined(__linux__) && defined(__GLIBC__) && ( __GLIBC__ > 2 || __GLIBC_MINOR__ >= 27 )
+            for( loff_t in = at, out = to; len; ) {
+                ssize_t n = copy_file_range( src.fd, &in, fd, &out, len, 0 );
+                if( n <= 0 ) break;
+                at += n, to += n, len -= n;
+            }
+#endif
+            for( uint64_t n; len; at += n, to += n, len -= n ) {
+                n = len < buf.size() ? len : buf.size();
+                if( !src.read( at, &buf[0], n ) || !write( to, &buf[0], n ) ) {
+                    return false;
+                }
+            }
+            return true;
+        }
+#ifndef JOURNEY_POSIX
+        bool seek( uint64_t at ) const {
+            return 0 == ( at == ~0ull ? _fseeki64( fp, 0, SEEK_END ) : _fseeki64( fp, int64_t( at ), SEEK_SET ) );
+        }
+#endif
+    };
+
+    // one step of a compaction: write 'literal' at 'to', or copy the journal range [from, from + len) there,
+    // or write the 'len' bytes of content of a delta entry ('rebased', along with its name) there,
+    // encrypted anew with nonce 'sealed' and 'salt' (if not 0)
+    struct op {
+        uint64_t to, from, len;
+        std::string literal;
+        const std::pair<const std::string *, entry> *rebased;
+        uint64_t sealed, salt[2];
+        uint64_t size() const {
+            return literal.empty() ? len : literal.size();
+        }
+    };
+
+    // entries picked for compaction: names live elsewhere (ie, in the toc)
+    typedef std::vector< std::pair<const std::string *, entry> > selection;
+
+    // the versions kept by a retention policy, once tombstones have dropped the versions they delete (the
+    // ones before them, by stamp and then by position) and themselves
+    static selection retained( const std::map< std::string, std::vector<entry> > &versions, const retention &policy ) {
+        auto before = []( const entry &a, const entry &b ) {
+            return a.stamp != b.stamp ? a.stamp < b.stamp : a.begin < b.begin;
+        };
+        std::vector< std::pair<const std::string *, const entry *> > prefixes;
+        for( auto &it : versions ) {
+            for( auto &e : it.second ) {
+                if( e.tombstone == 2 ) prefixes.push_back( std::make_pair( &it.first, &e ) );
+            }
+        }
+        selection kept;
+        for( auto &it : versions ) {
+            const entry *cut = 0;
+            for( auto &e : it.second ) {
+                if( e.tombstone == 1 && ( !cut || before( *cut, e ) ) ) cut = &e;
+            }
+            for( auto &p : prefixes ) {
+                if( !it.first.compare( 0, p.first->size(), *p.first ) && ( !cut || before( *cut, *p.second ) ) ) cut = p.second;
+            }
+            std::vector<entry> alive;
+            for( auto &e : it.second ) {
+                if( !e.tombstone && ( !cut || before( *cut, e ) ) ) alive.push_back( e );
+            }
+            for( auto &e : retain( alive, policy ) ) {
+                kept.push_back( std::make_pair( &it.first, e ) );
+            }
+        }
+        return kept;
+    }
+
+    // contents of the small entries of a selection, evenly sampled up to dict_samples bytes
+    std::vector<std::string> samples_of( const selection &live, const std::vector<std::string> &list, const std::vector<uint64_t> &offsets,
+                                         const std::map<std::string, entry> &parts, std::map<uint64_t, std::string> &cache ) const {
+        uint64_t total = 0, taken = 0, seen = 0;
+        for( auto &it : live ) {
+            uint64_t size = content_size( it.second );
+            total += size <= uint64_t( dict_entry_size ) ? size : 0;
+        }
+        std::vector<std::string> samples;
+        for( auto &it : live ) {
+            uint64_t size = content_size( it.second );
+            if( size > uint64_t( dict_entry_size ) || ( seen += size ) * dict_samples < ( taken + 1 ) * total ) {
+                continue;
+            }
+            samples.push_back( std::string() );
+            taken += fetch( list, offsets, parts, it.second, *it.first, samples.back(), cache ) ? size : ( samples.pop_back(), 0 );
+        }
+        return samples;
+    }
+
+    // footer index of a sealed journal: [count][bloom bytes][bloom hashes], 'count' sorted records of
+    // [name at][name len][offset][size][stamp][hash][raw size][dictionary][chunked size][crc], then the bloom
+    // filter and the names. empty when there is nothing to index (encrypted entries are left out).
+    std::string index_of( const selection &live, const std::vector<entry> &placed ) const {
+        std::string records, names, bits;
+        uint64_t count = 0, hashes = 7;
+        std::vector<uint64_t> keys;
+        for( size_t i = 0; i < live.size(); ++i ) {
+            const std::string &name = *live[i].first;
+            if( i + 1 < live.size() && *live[i + 1].first == name ) {
+                continue;
+            }
+            const entry &e = placed[i];
+            if( e.sealed ) {
+                continue;
+            }
+            for( uint64_t v : { uint64_t( names.size() ), uint64_t( name.size() ), e.offset, e.size, e.stamp, e.hash, e.raw, e.dict, e.chunked, e.crc } ) {
+                put64( records, v );
+            }
+            names += name;
+            keys.push_back( hash64( name.data(), name.size() ) );
+            count ++;
+        }
+        if( !count ) {
+            return std::string(); // nothing to index
+        }
+        bits.assign( ( count * 10 + 63 ) / 64 * 8, '\0' );
+        for( uint64_t h : keys ) {
+            for( uint64_t i = 0, bit; i < hashes; ++i ) {
+                bit = ( h + i * ( ( h >> 33 ) | 1 ) ) % ( bits.size() * 8 );
+                bits[ bit / 8 ] |= char( 1 << bit % 8 );
+            }
+        }
+        std::string head;
+        put64( head, count );
+        put64( head, bits.size() );
+        put64( head, hashes );
+        return head + records + bits + names;
+    }
+
+    // sorts a selection as requested by 'order'. names are ranked first (by path, newest stamp or first
+    // access), then versions of the same name follow the journal order.
+    void arrange( selection &live ) const {
+        std::map<std::string, uint64_t> rank;
+        if( order == by_stamp ) {
+            for( auto &it : live ) {
+                uint64_t &r = rank[ *it.first ];
+                r = r > it.second.stamp ? r : it.second.stamp;
+            }
+        }
+        if( order == by_trace ) {
+            for( auto &name : trace ) {
+                rank.insert( std::make_pair( name, rank.size() ) );
+            }
+        }
+        auto rank_of = [&]( const std::string &name ) {
+            auto found = rank.find( name );
+            return found == rank.end() ? ~0ull : found->second;
+        };
+        auto path_less = []( const std::string &a, const std::string &b ) {
+            return std::lexicographical_compare( a.begin(), a.end(), b.begin(), b.end(), []( char x, char y ) {
+                return ( x == '/' ? 0 : (unsigned char)x + 1 ) < ( y == '/' ? 0 : (unsigned char)y + 1 );
+            } );
+        };
+        std::sort( live.begin(), live.end(), [&]( const selection::value_type &a, const selection::value_type &b ) {
+            const std::string &x = *a.first, &y = *b.first;
+            if( seal && x != y ) {
+                return x < y;
+            }
+            if( order == by_path && x != y ) {
+                return path_less( x, y );
+            }
+            if( ( order == by_stamp || order == by_trace ) && x != y ) {
+                uint64_t rx = rank_of( x ), ry = rank_of( y );
+                if( rx != ry ) return rx < ry;
+                if( rx != ~0ull ) return x < y;
+            }
+            return a.second.begin < b.second.begin;
+        } );
+    }
 
-    struct entry {
-        uint64_t offset;
-        uint64_t size;
-        uint64_t stamp;
-    };
+    // lays out a selection in the given order, as appended at 'at'. entries keep their bytes when moved
+    // by a multiple of the alignment; the rest are re-framed. the live records of a pack are re-packed
+    // where the first of them goes. links become links to the copy of the data they share laid out before
+    // them, or copies of that data if there is none. copies are split in chunks so they can be spread
+    // across workers.
+    std::vector<op> layout( uint64_t at, const selection &live, std::vector<entry> &placed,
+                            std::map<uint64_t, std::string> *staged = 0 ) const {
+        std::vector<op> ops;
+        std::map< uint64_t, std::vector<size_t> > packs; // live records, by the begin of their pack
+        for( size_t i = 0; i < live.size(); ++i ) {
+            if( live[i].second.packed ) packs[ live[i].second.begin ].push_back( i );
+        }
+        std::map<uint64_t, size_t> shared; // entries laid out, by the offset of the data they came from
+        placed.assign( live.size(), entry() );
+        size_t i = 0;
+        auto copy = [&]( uint64_t from, uint64_t len ) {
+            for( uint64_t n; len; from += n, len -= n, at += n ) {
+                n = len < uint64_t( chunk_size ) ? len : uint64_t( chunk_size );
+                ops.push_back( op{ at, from, n, std::string(), 0, 0, { 0, 0 } } );
+            }
+        };
+        uint64_t run = 0, runlen = 0, runto = 0;
+        bool varint = varint_framed();
+        auto place = [&]( entry e, uint64_t from, uint64_t to ) {
+            shared.insert( std::make_pair( e.offset, i ) );
+            e.offset += to - from, e.begin += to - from, e.end += to - from;
+            placed[i] = e;
+        };
+        auto frame_any = [&]( std::string &head, std::string &tail, const std::string &name, uint64_t datalen, uint64_t stamp, const std::string &tags,
+                              uint64_t data_align ) {
+            if( !( varint && data_align <= 8 && frame3( head, tail, name, datalen, stamp, tags ) ) ) {
+                frame( head, tail, at, name, datalen, stamp, data_align, 8, tags );
+            }
+        };
+        for( ; i < live.size(); ++i ) {
+            auto &it = live[i];
+            const entry &e = it.second;
+            if( e.packed ) {
+                auto records = packs.find( e.begin );
+                if( records == packs.end() ) {
+                    continue;
+                }
+                copy( run, runlen );
+                runlen = 0;
+                std::string table, pack, head, tail;
+                uint64_t stamp = 0, size = 0;
+                for( size_t k : records->second ) {
+                    const entry &r = live[k].second;
+                    put_varint( table, live[k].first->size() );
+                    table += *live[k].first;
+                    put_varint( table, r.stamp );
+                    put_varint( table, r.size );
+                    stamp = stamp > r.stamp ? stamp : r.stamp;
+                    size += r.size;
+                }
+                put_varint( pack, table.size() );
+                pack += table;
+                frame_any( head, tail, reserved( "pack" ), pack.size() + size, stamp, std::string(), align );
+                uint64_t begin = at, end = at + head.size() + pack.size() + size + tail.size();
+                ops.push_back( op{ at, 0, 0, head, 0, 0, { 0, 0 } } );
+                at += head.size();
+                ops.push_back( op{ at, 0, 0, pack, 0, 0, { 0, 0 } } );
+                at += pack.size();
+                for( size_t k : records->second ) {
+                    const entry &r = live[k].second;
+                    shared.insert( std::make_pair( r.offset, k ) );
+                    placed[k] = r;
+                    placed[k].offset = at, placed[k].begin = begin, placed[k].end = end;
+                    copy( r.offset, r.size );
+                }
+                ops.push_back( op{ at, 0, 0, tail, 0, 0, { 0, 0 } } );
+                at += tail.size();
+                packs.erase( records );
+                continue;
+            }
+            auto found = staged ? staged->find( e.begin ) : std::map<uint64_t, std::string>::iterator();
+            bool restaged = staged && found != staged->end(), rebased = !restaged && e.delta;
+            auto share = e.link && !restaged ? shared.find( e.offset ) : shared.end();
+            if( share != shared.end() ) {
+                copy( run, runlen );
+                runlen = 0;
+                std::string target = stored_name( placed[share->second], *live[share->second].first );
+                std::string head, tail, tags;
+                put_tag( tags, tag_link, at + 1 - placed[share->second].end );
+                frame_any( head, tail, *it.first, target.size(), e.stamp, tags, 8 );
+                placed[i] = placed[share->second];
+                placed[i].stamp = e.stamp, placed[i].begin = at, placed[i].end = at + head.size() + target.size() + tail.size();
+                placed[i].link = at + 1 - placed[share->second].end, placed[i].packed = 0;
+                ops.push_back( op{ at, 0, 0, head + target + tail, 0, 0, { 0, 0 } } );
+                at = placed[i].end;
+                continue;
+            }
+            // format 3 entries can move anywhere, but only entries already in it are kept when writing it.
+            // data blocks keep their alignment, unless 'align' is larger: those entries are re-framed, so
+            // their tags record the new one. entries are kept where their data lands on that alignment.
+            uint64_t want = e.align > align ? e.align : align;
+            bool framed3 = e.offset - e.begin == stored_name( e, *it.first ).size();
+            bool kept = !restaged && !rebased && !e.link && ( framed3 ? want <= 8 : !varint || e.align > 8 ) && ( e.align > 8 ? e.align : 8 ) == want;
+            auto lands = [&]( uint64_t shift ) {
+                return framed3 || ( shift % 8 == 0 && ( e.offset + shift ) % want == 0 );
+            };
+            if( kept && runlen && run + runlen == e.begin && lands( runto - run ) ) {
+                place( e, run, runto );
+                runlen += e.end - e.begin;
+                continue;
+            }
+            copy( run, runlen );
+            runlen = 0;
+            if( kept && lands( at - e.begin ) ) {
+                place( e, run = e.begin, runto = at );
+                runlen = e.end - e.begin;
+                continue;
+            }
+            // delta entries are written in full, uncompressed
+            entry full = e;
+            full.link = 0, full.align = want > 8 ? want : 0;
+            if( rebased ) {
+                full.size = e.patched, full.raw = full.dict = full.delta = full.patched = full.crc = 0;
+                if( e.sealed ) {
+                    full.sealed = nonce_of( e.sealed & 1, full.salt ), full.size += 16;
+                }
+            }
+            std::string head, tail;
+            frame_any( head, tail, stored_name( full, *it.first ), full.size, e.stamp, tags_of( full ), want );
+            place( full, e.offset, at + head.size() );
+            placed[i].begin = at, placed[i].end = at + head.size() + full.size + tail.size();
+            ops.push_back( op{ at, 0, 0, head, 0, 0, { 0, 0 } } );
+            at += head.size();
+            if( restaged ) {
+                ops.push_back( op{ at, 0, 0, std::move( found->second ), 0, 0, { 0, 0 } } );
+                at += e.size;
+            } else if( rebased ) {
+                ops.push_back( op{ at, 0, full.size, std::string(), &it, full.sealed, { full.salt[0], full.salt[1] } } );
+                at += full.size;
+            } else {
+                copy( e.offset, e.size );
+            }
+            ops.push_back( op{ at, 0, 0, tail, 0, 0, { 0, 0 } } );
+            at += tail.size();
+        }
+        copy( run, runlen );
+        return ops;
+    }
 
-    journey()
-    {}
+    // lays a selection out as write_selection() would, into a new file. the estimated throughput is
+    // 'bytes_per_second', else 'compaction_rate', else 256 MiB/s per worker.
+    plan plan_of( selection &live, const std::vector<std::string> &list, const std::vector<uint64_t> &offsets,
+                  const std::map<std::string, entry> &parts, uint64_t bytes_per_second ) const {
+        plan p;
+        p.input = offsets.empty() ? 0 : offsets.back() + file_size( list.back() );
+        p.entries = live.size();
+        p.ok = with_parts( live, list, offsets, parts, true );
+        arrange( live );
+        std::vector<entry> placed;
+        for( auto &o : layout( 0, live, placed ) ) {
+            p.output += o.size();
+        }
+        uint64_t len = seal ? index_of( live, placed ).size() : 0;
+        if( len ) {
+            std::string head, tail;
+            frame( head, tail, p.output, reserved( "index" ), len, 0, 8, 8, std::string() );
+            p.output += head.size() + len + tail.size();
+        }
+        uint64_t rate = bytes_per_second ? bytes_per_second : compaction_rate ? compaction_rate : ( threads > 1 ? threads : 1 ) * ( 256ull << 20 );
+        p.reclaimable = p.input > p.output ? p.input - p.output : 0;
+        p.seconds = double( p.output ) / rate;
+        return p;
+    }
 
-    journey( const std::string &file ) {
-        init( file );
+    // adds the parts a selection depends on to it: the chunks listed by its chunked entries, the
+    // dictionaries any of them were packed against, and the newest dictionary too (for later appends)
+    bool with_parts( selection &live, const std::vector<std::string> &list, const std::vector<uint64_t> &offsets,
+                     const std::map<std::string, entry> &parts, bool newest ) const {
+        std::vector<std::string> names;
+        auto add = [&]() {
+            std::sort( names.begin(), names.end() );
+            names.erase( std::unique( names.begin(), names.end() ), names.end() );
+            for( auto &name : names ) {
+                auto found = parts.find( name );
+                if( found != parts.end() ) live.push_back( std::make_pair( &found->first, found->second ) );
+            }
+            names.clear();
+        };
+        for( size_t i = 0, count = live.size(); i < count; ++i ) {
+            std::string manifest( live[i].second.chunked ? live[i].second.size : 0, '\0' );
+            if( !manifest.empty() && ( !read_at( list, offsets, live[i].second.offset, manifest ) || !unseal_data( live[i].second, *live[i].first, manifest ) ) ) {
+                return false;
+            }
+            for( size_t at = 0; at + 16 <= manifest.size(); at += 16 ) {
+                names.push_back( chunk_name( get64( &manifest[at] ) ) );
+            }
+        }
+        add();
+        for( auto &it : live ) {
+            if( it.second.dict ) names.push_back( dict_name( it.second.dict ) );
+        }
+        const std::pair<const std::string, entry> *last = 0;
+        for( auto &it : parts ) {
+            bool dict = !it.first.compare( 0, 12, reserved( "dictionary:" ) );
+            if( newest && dict && ( !last || it.second.begin > last->second.begin ) ) last = &it;
+        }
+        if( last ) names.push_back( last->first );
+        add();
+        return true;
     }
 
-    bool init( const std::string &file ) {
-        *this = journey();
-        return file.empty() ? false : (journal = file, true);
+    // trains a new dictionary out of a selection, and re-encodes its small entries against it, up to
+    // stage_size bytes. the new dictionary joins the selection as 'name'. re-encoded entries (and the
+    // dictionary) are staged in memory, by their begin offset.
+    void restage( selection &live, const std::vector<std::string> &list, const std::vector<uint64_t> &offsets,
+                  const std::map<std::string, entry> &parts, std::map<uint64_t, std::string> &staged, std::string &name ) const {
+        std::map<uint64_t, std::string> cache;
+        std::string dict = train_dictionary( samples_of( live, list, offsets, parts, cache ), dictionary_limit() ), content;
+        if( dict.empty() ) {
+            return;
+        }
+        uint64_t id = hash64( dict.data(), dict.size() ) | 1, bytes = 0, last = 0;
+        for( auto &it : live ) {
+            entry &e = it.second;
+            last = last > e.end ? last : e.end;
+            if( e.packed || e.link || content_size( e ) > uint64_t( dict_entry_size ) || bytes > uint64_t( stage_size ) || !fetch( list, offsets, parts, e, *it.first, content, cache ) ) {
+                continue;
+            }
+            std::string packed = pack( content.data(), content.size(), dict );
+            if( !packed.empty() && packed.size() < e.size ) {
+                e.raw = content.size(), e.dict = id, e.size = packed.size(), e.chunked = e.delta = e.patched = 0;
+                if( e.sealed ) {
+                    e.sealed = nonce_of( e.sealed & 1, e.salt );
+                    seal_data( packed, e.sealed, e.salt, *it.first, e.stamp );
+                    e.size = packed.size();
+                }
+                e.crc = e.crc || checksum ? crc32c( packed.data(), packed.size() ) | 1ull << 32 : 0;
+                bytes += packed.size();
+                staged[ e.begin ].swap( packed );
+            }
+        }
+        uint64_t salt[2] = { 0, 0 }, nonce = key.empty() ? 0 : nonce_of( false, salt ), stamp = std::time(0);
+        name = dict_name( id );
+        if( nonce ) {
+            seal_data( dict, nonce, salt, name, stamp );
+        }
+        live.push_back( std::make_pair( &name, entry{ 0, dict.size(), stamp, id, last + 1, last + 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, nonce, { salt[0], salt[1] } } ) );
+        staged[ last + 1 ].swap( dict );
     }
 
-    bool load( uint64_t beg_stamp = 0, uint64_t end_stamp = std::time(0), std::ostream *debugstream = 0 ) {
-        init( std::string(journal) );
-        if( beg_stamp > end_stamp ) {
+    // appends a selection of entries to another journal (see compact()). 'list' and 'offsets' are the
+    // segments the entries were loaded from, and their logical offsets. 'parts' are the dictionaries
+    // found there, which are carried over as needed.
+    bool write_selection( const std::string &new_journal_file, selection &live, const std::vector<std::string> &list,
+                          const std::vector<uint64_t> &offsets, const std::map<std::string, entry> &parts ) const {
+        handle out;
+        if( !alignable( align ) || !out.open( new_journal_file, true ) ) {
             return false;
         }
-        std::ifstream ifs( journal.c_str(), std::ios::binary | std::ios::ate );
-        auto skip_padding = [&] {
-            int pad = (((uint64_t(ifs.tellg()) + 8) & ~7) - uint64_t(ifs.tellg())) % 8;
-            ifs.ignore( pad );
+        std::map<uint64_t, std::string> staged;
+        std::string name;
+        if( retrain ) {
+            restage( live, list, offsets, parts, staged, name );
+        }
+        if( !with_parts( live, list, offsets, parts, name.empty() ) ) {
+            return false;
+        }
+        arrange( live );
+        std::vector<entry> placed;
+        std::vector<op> ops = layout( out.size(), live, placed, &staged );
+        uint64_t total = 0;
+        for( auto &o : ops ) {
+            total += o.size();
+        }
+        unsigned workers = threads > 1 ? threads : 1;
+        std::vector<size_t> cuts( 1, 0 );
+        for( size_t i = 0, done = 0; i < ops.size(); done += ops[i++].size() ) {
+            if( done >= total / workers * cuts.size() && cuts.size() < workers && i ) cuts.push_back( i );
+        }
+        cuts.push_back( ops.size() );
+        std::vector<char> oks( cuts.size() - 1, false );
+        auto work = [&]( size_t k ) {
+            std::vector<handle> src( list.size() );
+            std::vector<char> buf( bounce_size );
+            std::map<uint64_t, std::string> cache;
+            std::string content;
+            handle dst;
+            bool ok = dst.open( new_journal_file, true );
+            auto start = std::chrono::steady_clock::now();
+            double done = 0, rate = double( compaction_rate ) / ( cuts.size() - 1 );
+            for( size_t i = cuts[k]; ok && i < cuts[k + 1]; ++i ) {
+                const op &o = ops[i];
+                if( o.rebased ) {
+                    const std::string &name = *o.rebased->first;
+                    const entry &e = o.rebased->second;
+                    ok = fetch( list, offsets, parts, e, name, content, cache ) && ( !o.sealed || seal_data( content, o.sealed, o.salt, name, e.stamp ) )
+                         && content.size() == o.len && dst.write( o.to, content.data(), o.len );
+                } else {
+                    ok = o.literal.empty() ? copy_out( list, offsets, src, dst, o.to, o.from, o.len, buf ) : dst.write( o.to, o.literal.data(), o.literal.size() );
+                }
+                if( compaction_rate ) {
+                    done += o.size();
+                    std::this_thread::sleep_until( start + std::chrono::microseconds( uint64_t( done / rate * 1e6 ) ) );
+                }
+            }
+            oks[k] = dst.close() && ok;
         };
-        std::string fname;
-        unsigned count = 0;
-        while( ifs.good() && ifs.tellg() >= (8 * 5) ) {
-            uint64_t stamp, namelen, datalen, filelen, magic;
-            ifs.seekg( -8*5, ifs.cur );
-            ifs.read( (char *)&stamp,   8 );
-            ifs.read( (char *)&namelen, 8 );
-            ifs.read( (char *)&datalen, 8 );
-            ifs.read( (char *)&filelen, 8 );
-            ifs.read( (char *)&magic,   8 );
-            if( magic != magic_right_endian && magic != magic_wrong_endian ) {
-                break;
+        std::vector<std::thread> pool;
+        for( size_t k = 1; k < oks.size(); ++k ) {
+            pool.push_back( std::thread( work, k ) );
+        }
+        work( 0 );
+        for( auto &t : pool ) {
+            t.join();
+        }
+        bool ok = out.close() && std::count( oks.begin(), oks.end(), false ) == 0;
+        std::string index = ok && seal ? index_of( live, placed ) : std::string();
+        if( !index.empty() ) {
+            ok = append_file( new_journal_file, reserved( "index" ), index.data(), index.size(), std::time(0), false );
+        }
+        return ok;
+    }
+
+    // streams the logical range [from, from + len) of some segments into 'out' at 'to'
+    static bool copy_out( const std::vector<std::string> &list, const std::vector<uint64_t> &offsets, std::vector<handle> &src,
+                          handle &out, uint64_t to, uint64_t from, uint64_t len, std::vector<char> &buf ) {
+        while( len ) {
+            size_t i = std::upper_bound( offsets.begin(), offsets.end(), from ) - offsets.begin() - 1;
+            uint64_t avail = i + 1 < offsets.size() ? offsets[i + 1] - from : len, n = len < avail ? len : avail;
+            if( !src[i].is_open() && !src[i].open( list[i], false ) ) {
+                return false;
+            }
+            if( !out.copy( to, src[i], from - offsets[i], n, buf ) ) {
+                return false;
             }
+            to += n, from += n, len -= n;
+        }
+        return true;
+    }
+
+#ifdef JOURNEY_POSIX
+
+    static bool write_all( int fd, struct iovec *iov, int n ) {
+        while( n ) {
+            for( ; n && !iov->iov_len; ++iov, --n ) {}
+            ssize_t w = n ? writev( fd, iov, n ) : 0;
+            if( w < 0 && errno == EINTR ) continue;
+            if( n && w <= 0 ) return false;
+            for( ; n && size_t(w) >= iov->iov_len; w -= iov->iov_len, ++iov, --n ) {}
+            if( n ) iov->iov_base = (char *)iov->iov_base + w, iov->iov_len -= w;
+        }
+        return true;
+    }
 
-            ifs.seekg( -8*5-int64_t(filelen), ifs.cur );
-            skip_padding();
+    // reserves space past the end of file, up to the next multiple of 'prealloc', without changing its
+    // size, whenever the blocks already allocated cannot hold the next 'bytes'. best effort: errors are
+    // ignored.
+    void preallocate( int fd, const struct stat &st, uint64_t bytes ) const {
+        uint64_t size = st.st_size, reserved = uint64_t( st.st_blocks ) * 512;
+        if( !prealloc || reserved >= size + bytes ) {
+            return;
+        }
+        uint64_t extent = bytes + pad( size + bytes, prealloc );
+#if defined(FALLOC_FL_KEEP_SIZE)
+        (void)fallocate( fd, FALLOC_FL_KEEP_SIZE, size, extent );
+#elif defined(F_PREALLOCATE)
+        fstore_t store = { F_ALLOCATEALL, F_PEOFPOSMODE, 0, off_t(extent), 0 };
+        (void)fcntl( fd, F_PREALLOCATE, &store );
+#else
+        (void)fd, (void)extent;
+#endif
+    }
 
-            fname.resize( namelen );
-            ifs.read( &fname[0], namelen );
-            ifs.ignore(1);
-            skip_padding();
+    static int open_direct( const std::string &file, int flags ) {
+        int fd = -1;
+#ifdef O_DIRECT
+        fd = ::open( file.c_str(), flags | O_DIRECT, 0644 );
+        if( fd < 0 && errno == EINVAL )
+#endif
+        fd = ::open( file.c_str(), flags, 0644 );
+#ifdef F_NOCACHE
+        if( fd >= 0 ) fcntl( fd, F_NOCACHE, 1 );
+#endif
+        return fd;
+    }
 
-            bool inscribed = ( stamp >= beg_stamp && stamp <= end_stamp && toc.find( fname ) == toc.end() ); 
-            if( inscribed ) {
-                toc[ fname ] = entry{ (uint64_t)ifs.tellg(), datalen, stamp };
+    // opens a journal file and locks it for exclusive appending. retries when the file gets swapped
+    // (ie, by compact_in_place()) while waiting for the lock, so no append lands in a stale file.
+    static int open_locked( const std::string &file, int flags, bool direct ) {
+        for( ;; ) {
+            int fd = direct ? open_direct( file, flags ) : ::open( file.c_str(), flags, 0644 );
+            if( fd < 0 ) {
+                return -1;
             }
-            if( debugstream ) {
-                std::string brief( datalen > 16 ? 16 : datalen, '\0' ), action[2] = { "skipped", "inscribed" };
-                ifs.read( &brief[0], datalen > 16 ? 16 : datalen );
-                ifs.ignore( datalen > 16 ? datalen - 16 : 0 );
-                *debugstream << "v1 - " << action[inscribed] << " '" << fname << "' " << datalen << " datalen; stamp=" << stamp << "; brief=" << brief << std::endl;
-            } else {
-                ifs.ignore( datalen );
+            while( flock( fd, LOCK_EX ) < 0 && errno == EINTR ) {}
+            struct stat a, b;
+            bool found = 0 == stat( file.c_str(), &b );
+            if( found && 0 == fstat( fd, &a ) && a.st_dev == b.st_dev && a.st_ino == b.st_ino ) {
+                return fd;
+            }
+            close( fd );
+            if( !found && !( flags & O_CREAT ) ) {
+                return -1;
             }
-            skip_padding();
-
-            ifs.seekg( -int64_t(filelen), ifs.cur );
-            count ++;
-        }
-        if( debugstream ) {
-            *debugstream << "---" << std::endl;
         }
-        return ifs.good() && count > 0;
     }
 
-    std::map<std::string, entry> get_toc() const {
-        return toc;
+    // size of a journal file while no writer is appending to it, that is, on an entry boundary
+    static bool settled_size( const std::string &file, uint64_t &size ) {
+        int fd = open_locked( file, O_RDONLY, false );
+        struct stat st;
+        bool ok = fd >= 0 && 0 == fstat( fd, &st );
+        size = ok ? st.st_size : 0;
+        if( fd >= 0 ) close( fd );
+        return ok;
     }
 
-    template<typename T>
-    bool read( T &data, const std::string &name ) const {
-        auto found = toc.find(name);
-        if( found != toc.end() ) {
-            auto &entry = found->second;
-            data.resize( entry.size );
-            std::ifstream ifs( journal.c_str(), std::ios::binary );
-            ifs.seekg( entry.offset );
-            ifs.read( &data[0], entry.size );
-            if( ifs.good() ) {
-                return true;
+    static bool read_direct( const std::string &file, char *dst, uint64_t offset, uint64_t size ) {
+        void *buf = 0;
+        int fd = open_direct( file, O_RDONLY );
+        bool ok = fd >= 0 && 0 == posix_memalign( &buf, page, bounce_size );
+        for( uint64_t at = offset - offset % page, end = offset + size; ok && at < end; at += bounce_size ) {
+            ssize_t got = pread( fd, buf, bounce_size, at );
+            uint64_t lo = at > offset ? at : offset, hi = at + (got > 0 ? got : 0);
+            hi = hi < end ? hi : end;
+            ok = got > 0 && hi > lo;
+            if( ok ) {
+                memcpy( dst + (lo - offset), (char *)buf + (lo - at), hi - lo );
             }
         }
-        return (data = T(), false);
+        if( fd >= 0 ) close( fd );
+        free( buf );
+        return ok;
     }
 
-    std::string read( const std::string &name ) const {
-        std::string data;
-        return read( data, name ) ? data : std::string();
+    // locks the sibling file a compaction in place writes to, and empties it. fails if another compaction
+    // holds it. the lock is held until the compaction completes (see release_sibling()).
+    int lock_sibling() const {
+        std::string tmp = journal + ".compacting";
+        int fd = ::open( tmp.c_str(), O_RDWR | O_CREAT, 0644 );
+        struct stat a, b;
+        // the file may have been swapped in by the compaction that held it meanwhile
+        if( fd >= 0 && 0 == flock( fd, LOCK_EX | LOCK_NB ) && 0 == fstat( fd, &a ) && 0 == stat( tmp.c_str(), &b )
+            && a.st_dev == b.st_dev && a.st_ino == b.st_ino && 0 == ftruncate( fd, 0 ) ) {
+            return fd;
+        }
+        if( fd >= 0 ) close( fd );
+        return -1;
     }
 
-    bool append( const std::string &filename, const void *ptr, size_t len, uint64_t stamp = std::time(0) ) const {
-        if( journal.size() && ptr && !filename.empty() ) {
-            std::ofstream ofs( journal.c_str(), std::ios::binary | std::ios::app | std::ios::ate );
-            auto write_padding = [&] {
-                char buf[8] = {0};
-                int pad = (((uint64_t(ofs.tellp()) + 8) & ~7) - uint64_t(ofs.tellp())) % 8;
-                ofs.write( buf, pad );
-            };
-            if( ofs.good() ) {
-                uint64_t namelen = filename.size(), datalen = len;
-                uint64_t filelen = -int64_t( ofs.tellp() ), magic = magic_right_endian;
-                write_padding();
-                ofs.write( filename.c_str(), namelen );
-                ofs.write( "\0", 1 );
-                write_padding();
-                ofs.write( (const char *)ptr, datalen );
-                write_padding();
-                filelen += int64_t(ofs.tellp());
-                ofs.write( (const char *)&stamp,   8 );
-                ofs.write( (const char *)&namelen, 8 );
-                ofs.write( (const char *)&datalen, 8 );
-                ofs.write( (const char *)&filelen, 8 );
-                ofs.write( (const char *)&magic,   8 );
-            }
-            return ofs.good();
+    // unlocks the sibling file, and removes it unless it was swapped in. returns 'swapped'.
+    bool release_sibling( int &lock, bool swapped ) const {
+        if( lock >= 0 ) {
+            if( !swapped ) ::unlink( ( journal + ".compacting" ).c_str() );
+            close( lock );
+            lock = -1;
         }
-        return false;
+        return swapped;
     }
 
-    bool compact( const std::string &new_journal_file ) const {
-        if( toc.empty() ) {
+    // first half of compact_in_place(): compacts the journal, as of its current end of file 'at', into
+    // a sibling file, locked into 'lock'
+    bool compact_prefix( uint64_t &at, int &lock ) const {
+        std::vector<std::string> list = segments();
+        std::string tmp = journal + ".compacting";
+        if( list.size() != 1 || list[0] != journal || !settled_size( journal, at ) || ( lock = lock_sibling() ) < 0 ) {
             return false;
         }
-        std::string data;
-        journey j2( new_journal_file );
-        // preload everything (this can be memory hungry)
-        for( auto &entry : toc ) {
-            const char *name = entry.first.c_str();
-            const auto &info = entry.second;
-            if( !read( data, name ) ) {
+        journey snap( *this );
+        unsigned count = 0;
+        snap.toc.clear();
+        snap.files.assign( 1, journal );
+        snap.bases.assign( 1, 0 );
+        return snap.load_file( journal, 0, 0, ~0ull, 0, count, at ) && ( snap.toc.empty() || snap.compact( tmp ) );
+    }
+
+    // second half of compact_in_place(): catches the sibling up with whatever was appended past 'at'
+    // meanwhile, then swaps it in
+    bool compact_tail( uint64_t at ) const {
+        std::string tmp = journal + ".compacting";
+        handle in, out;
+        std::vector<char> buf( bounce_size );
+        if( !in.open( journal, false ) || !out.open( tmp, true ) ) {
+            return false;
+        }
+        // tail entries are copied verbatim, so keep their alignment
+        uint64_t to = out.size(), boundary = direct_io && align < uint64_t(page) ? uint64_t(page) : ( align > 8 ? align : 8 );
+        if( to % boundary != at % boundary ) {
+            uint64_t end = to + 8*6;
+            end += ( at % boundary + boundary - end % boundary ) % boundary;
+            std::string blob = filler( to, end );
+            if( !out.write( to, blob.data(), blob.size() ) ) {
+                return false;
+            }
+            to = end;
+        }
+        uint64_t eof;
+        for( int round = 0; round < 16 && settled_size( journal, eof ) && eof - at > uint64_t(bounce_size); ++round ) {
+            if( !movable( at, eof, boundary ) || !out.copy( to, in, at, eof - at, buf ) ) {
                 return false;
             }
-            if( !j2.append( name, &data[0], data.size(), info.stamp ) ) {
+            to += eof - at, at = eof;
+        }
+        int lock = open_locked( journal, O_RDONLY, false );
+        struct stat st;
+        bool ok = lock >= 0 && 0 == fstat( lock, &st ) && uint64_t( st.st_size ) >= at;
+        ok = ok && movable( at, st.st_size, boundary ) && out.copy( to, in, at, st.st_size - at, buf ) && out.sync() && out.close();
+        ok = ok && 0 == rename( tmp.c_str(), journal.c_str() );
+        if( lock >= 0 ) close( lock );
+        return ok;
+    }
+
+    // whether the entries in [from, to) of the journal can be moved as a block, by a multiple of 'boundary':
+    // none of them may be aligned beyond it, nor be a delta against a version before 'from' (or a link to
+    // an entry there), which compact_prefix() has moved elsewhere
+    bool movable( uint64_t from, uint64_t to, uint64_t boundary ) const {
+        std::vector<std::string> list( 1, journal );
+        std::vector<uint64_t> offsets( 1, 0 );
+        entry e;
+        for( ; to > from; to = e.begin ) {
+            if( !entry_at( list, offsets, to, e ) || ( e.delta && e.begin + 1 - e.delta <= from ) || ( e.link && e.begin + 1 - e.link <= from ) || e.align > boundary ) {
                 return false;
             }
         }
         return true;
     }
 
-    protected:
+    // starts a background compact_prefix() when the policy asks for it. settle() completes it.
+    void maybe_compact() const {
+        bool wanted = compaction_policy ? compaction_policy( *this ) : auto_compact > 0 && space_amplification() >= auto_compact;
+        if( compaction || !wanted ) {
+            return;
+        }
+        journey snap( *this );
+        snap.compaction_policy = nullptr;
+        snap.prealloc = 0;
+        compaction = std::make_shared<background>();
+        background *job = compaction.get();
+        job->sibling = journal + ".compacting";
+        job->worker = std::thread( [job, snap] { job->ok = snap.compact_prefix( job->at, job->lock ); } );
+    }
+
+    // appends a page-padded entry. a partial trailing page (left by a buffered writer) is read back
+    // and rewritten, since O_DIRECT only writes whole pages at page offsets.
+    bool append_direct( const std::string &file, const std::string &name, const char *ptr, uint64_t len, uint64_t stamp,
+                        const std::string &tags, uint64_t *written, uint64_t refers ) const {
+        void *buf = 0;
+        struct stat st;
+        int fd = open_locked( file, O_RDWR | O_CREAT, true );
+        bool ok = fd >= 0 && 0 == fstat( fd, &st ) && uint64_t( st.st_size ) >= refers && 0 == posix_memalign( &buf, page, bounce_size );
+        if( ok ) {
+            uint64_t size = st.st_size, at = size - size % page, fill = size - at;
+            ok = !fill || pread( fd, buf, page, at ) >= ssize_t(fill);
+            std::string head, tail;
+            frame( head, tail, size, name, len, stamp, align > uint64_t(page) ? align : uint64_t(page), page, relative_tags( tags, size, refers ) );
+            preallocate( fd, st, head.size() + len + tail.size() );
+            if( written ) *written = head.size() + len + tail.size();
+            auto put = [&]( const char *src, uint64_t n ) {
+                while( ok && n ) {
+                    uint64_t chunk = bounce_size - fill < n ? bounce_size - fill : n;
+                    memcpy( (char *)buf + fill, src, chunk );
+                    src += chunk, n -= chunk, fill += chunk;
+                    if( fill == bounce_size ) {
+                        ok = pwrite( fd, buf, fill, at ) == ssize_t(fill);
+                        at += fill, fill = 0;
+                    }
+                }
+            };
+            put( head.data(), head.size() );
+            put( ptr, len );
+            put( tail.data(), tail.size() );
+            ok = ok && ( !fill || pwrite( fd, buf, fill, at ) == ssize_t(fill) );
+        }
+        if( fd >= 0 ) ok = ( 0 == close( fd ) ) && ok;
+        free( buf );
+        return ok;
+    }
+#endif
+
+    // waits for a background compaction, if this is its last owner, and swaps its output in
+    void settle() {
+        std::shared_ptr<background> job;
+        job.swap( compaction );
+        if( job && job.unique() && job->worker.joinable() ) {
+            job->worker.join();
+#ifdef JOURNEY_POSIX
+            release_sibling( job->lock, job->ok && compact_tail( job->at ) );
+#endif
+        }
+    }
+
+    struct background {
+        std::thread worker;
+        std::string sibling; // file compacted into
+        uint64_t at = 0;
+        int lock = -1; // on the sibling file, while compacting
+        bool ok = false;
+        // a compaction left unsettled (ie, its journey was assigned over) is waited for and discarded
+        ~background() {
+            if( worker.joinable() ) {
+                worker.join();
+            }
+#ifdef JOURNEY_POSIX
+            if( lock >= 0 ) {
+                ::unlink( sibling.c_str() );
+                ::close( lock );
+            }
+#endif
+        }
+    };
+
     std::string journal;
+    std::shared_ptr<const char> footer;
+    uint64_t footer_size = 0;
+    std::vector<std::string> files;
+    std::vector<uint64_t> bases;
     uint64_t magic_right_endian = 0x3179656E72756F6A; // 'journey1'
     uint64_t magic_wrong_endian = 0x6A6F75726E657931; // 'journey1' swapped
     std::map< std::string, entry > toc;
+    mutable std::map< std::string, uint64_t > appended; // extents of the entries appended since load()
+    mutable uint64_t bytes_live = 0, bytes_total = 0;
+    uint64_t torn_bytes = 0; // torn tail found by load()
+    uint64_t loaded_range[2] = { 0, 0 }; // stamp range of the last load()
+    mutable std::shared_ptr<background> compaction;
+    std::map< std::string, entry > parts; // dictionaries, by name
+    mutable std::map< uint64_t, std::string > dict_cache; // dictionary contents, by id
+    uint64_t active = 0; // id of the newest dictionary
+    mutable std::set< uint64_t > verified; // offsets of the entries whose crc was checked since load()
+    struct copyable_mutex : std::mutex { // copies of a journey get a mutex of their own
+        copyable_mutex() {}
+        copyable_mutex( const copyable_mutex & ) {}
+        copyable_mutex &operator=( const copyable_mutex & ) { return *this; }
+    };
+    mutable copyable_mutex cache_mutex; // guards dict_cache and verified, so that read() is thread-safe
+    std::map< std::string, entry > erased; // names whose latest version is a tombstone
+    std::vector< std::pair<std::string, entry> > erased_prefixes; // prefix tombstones, newest first
+    std::map< uint64_t, std::string > hashed; // names of the loaded entries, by content hash (dedupe)
 };
 
 
@@ -214,6 +3310,8 @@ public:
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <atomic>
+#include <sstream>
 #define suite(...) if(printf("------ %d ", __LINE__), printf(__VA_ARGS__), puts(""), true)
 #define test(...)  (errno=0,++tst,err+=!(ok=!!(__VA_ARGS__))),printf("[%s] %d %s (%s)\n",ok?" OK ":"FAIL",__LINE__,#__VA_ARGS__,strerror(errno))
 unsigned tst=0,err=0,ok=atexit([]{ suite("summary"){ printf("[%s] %d tests = %d passed + %d errors\n",err?"FAIL":" OK ",tst,tst-err,err); }});
@@ -268,6 +3366,940 @@ int main() {
         test( j2.load(0, now, debugstream) );
         test( j2.read( "hello.txt" ) == "latest" );
     }
+
+    suite( "page aligned entries, through O_DIRECT, mixed with regular ones" ) {
+        std::string big( 10000, 'x' );
+        journey j3;
+        test( j3.init( "journey3.joy" ) );
+        test( j3.append( "odd.txt", "odd", 3, past ) );
+        j3.direct_io = true;
+        test( j3.append( "big.bin", big.c_str(), big.size(), past ) );
+        test( j3.append( "small.txt", "small", 5, past ) );
+        j3.direct_io = false;
+        test( j3.append( "tail.txt", "tail", 4, past ) );
+        test( j3.load(0, now, debugstream) );
+        test( j3.get_toc().size() == 4 );
+        test( j3.get_toc()["big.bin"].offset % 4096 == 0 );
+        test( j3.get_toc()["small.txt"].offset % 4096 == 0 );
+        test( j3.read( "odd.txt" ) == "odd" && j3.read( "tail.txt" ) == "tail" );
+        j3.direct_io = true;
+        test( j3.read( "big.bin" ) == big && j3.read( "small.txt" ) == "small" );
+    }
+
+    suite( "segmented journal, rolling over at a size threshold" ) {
+        journey j4;
+        test( j4.init( "journey4.joy" ) );
+        j4.segment_size = 256;
+        j4.prealloc = 1 << 20;
+        for( int i = 0; i < 8; ++i ) {
+            std::string data( 100, 'a' + i );
+            test( j4.append( "file" + std::to_string(i % 5), data.c_str(), data.size(), past + i ) );
+        }
+        test( j4.trim() );
+        test( std::ifstream( "journey4.0001.joy" ).good() && std::ifstream( "journey4.0004.joy" ).good() );
+        journey j5( "journey4.joy" );
+        test( j5.load(0, now, debugstream) );
+        test( j5.get_toc().size() == 5 );
+        test( j5.read( "file0" ) == std::string( 100, 'f' ) && j5.read( "file4" ) == std::string( 100, 'e' ) );
+        test( j5.compact( "journey5.joy" ) );
+        test( j5.load(0, past + 2, debugstream) && j5.read( "file1" ) == std::string( 100, 'b' ) );
+#ifdef JOURNEY_POSIX
+        // trims take the append lock, so they never cut off a concurrent append
+        std::remove( "journey70.joy" );
+        journey j70( "journey70.joy" );
+        j70.prealloc = 1 << 16;
+        bool appended = true;
+        std::atomic<bool> done( false );
+        std::thread trimmer( [&] {
+            journey t( "journey70.joy" );
+            while( !done ) t.trim();
+        } );
+        for( int i = 0; i < 5000; ++i ) {
+            appended = j70.append( "f" + std::to_string( i ), "data", 4, past ) && appended;
+        }
+        done = true;
+        trimmer.join();
+        test( appended && j70.load(0, now, debugstream) && j70.get_toc().size() == 5000 && j70.torn() == 0 );
+        // preallocation reserves up to the next extent boundary, not a whole extent more
+        std::remove( "journey71.joy" );
+        journey j71( "journey71.joy" );
+        j71.prealloc = 1 << 20;
+        struct stat st;
+        test( j71.append( "small", "small", 5, past ) && 0 == stat( "journey71.joy", &st ) && uint64_t( st.st_blocks ) * 512 <= j71.prealloc );
+#endif
+    }
+
+    suite( "content hashes, and deduplicated appends" ) {
+        test( journey::hash64( "", 0 ) == 0xEF46DB3751D8E999ULL && journey::hash64( "abc", 3 ) == 0x44BC2CF5AD770999ULL );
+        test( journey::hash64( std::string( 100, 'z' ).c_str(), 100 ) == 0xD30E21C99C2A766DULL );
+        journey j6( "journey6.joy" );
+        j6.dedupe = true;
+        test( j6.append( "a.txt", "same", 4, past ) && j6.append( "b.txt", "other", 5, past ) );
+        test( j6.load(0, now, debugstream) && j6.get_toc()["a.txt"].hash != 0 );
+        std::ifstream before( "journey6.joy", std::ios::binary | std::ios::ate );
+        test( j6.append( "a.txt", "same", 4, now ) );
+        std::ifstream after( "journey6.joy", std::ios::binary | std::ios::ate );
+        test( before.tellg() == after.tellg() );
+        test( j6.append( "b.txt", "changed", 7, now ) );
+        test( j6.load(0, now, debugstream) && j6.read( "a.txt" ) == "same" && j6.read( "b.txt" ) == "changed" );
+        test( j6.get_toc()["a.txt"].stamp == past && j6.get_toc()["b.txt"].hash == ( journey::hash64( "changed", 7 ) | 1 ) );
+    }
+
+    suite( "streamed compaction, coalescing adjacent live entries" ) {
+        journey j7( "journey6.joy" );
+        test( j7.load(0, now, debugstream) );
+        auto toc = j7.get_toc();
+        test( toc["a.txt"].end != toc["b.txt"].begin );
+        std::remove( "journey7.joy" );
+        test( j7.compact( "journey7.joy" ) );
+        journey j8( "journey7.joy" );
+        test( j8.load(0, now, debugstream) && j8.read( "a.txt" ) == "same" && j8.read( "b.txt" ) == "changed" );
+        test( j8.get_toc()["a.txt"].hash == toc["a.txt"].hash && j8.get_toc()["b.txt"].stamp == now );
+        test( j8.get_toc()["a.txt"].end == j8.get_toc()["b.txt"].begin );
+        test( std::ifstream( "journey7.joy", std::ios::binary | std::ios::ate ).tellg() ==
+              int64_t( toc["a.txt"].end - toc["a.txt"].begin + toc["b.txt"].end - toc["b.txt"].begin ) );
+    }
+
+    suite( "parallel compaction" ) {
+        journey j9( "journey9.joy" );
+        std::string blob;
+        bool appended = true;
+        j9.align = 64;
+        for( int i = 0; i < 64; ++i ) {
+            blob.assign( 1000 + i * 37, char( 'A' + i % 26 ) );
+            appended = appended && j9.append( "item" + std::to_string( i % 40 ), blob.c_str(), blob.size(), past + i );
+        }
+        test( appended );
+        j9.threads = 4;
+        test( j9.load(0, now, debugstream) );
+        test( j9.compact( "journey10.joy" ) );
+        journey j10( "journey10.joy" );
+        test( j10.load(0, now, debugstream) && j10.get_toc().size() == 40 );
+        bool same = true;
+        for( auto &it : j9.get_toc() ) {
+            same = same && j10.read( it.first ) == j9.read( it.first ) && j10.get_toc()[ it.first ].offset % 64 == 0;
+        }
+        test( same );
+    }
+
+    suite( "compaction with retention policies" ) {
+        uint64_t T = 1000 * 86400ULL, stamps[] = { T - 40 * 86400, T - 20 * 86400, T - 3 * 86400, T - 86400 - 5, T - 2, T - 1 };
+        std::remove( "journey12.joy" );
+        journey j12( "journey12.joy" );
+        for( auto stamp : stamps ) {
+            std::string data = std::to_string( stamp );
+            j12.append( "f", data.c_str(), data.size(), stamp );
+        }
+        j12.append( "g", "g", 1, T - 40 * 86400 );
+        auto kept = [&]( const journey::retention &policy ) {
+            std::remove( "journey13.joy" );
+            journey j13( "journey13.joy" );
+            std::string found;
+            if( j12.compact( "journey13.joy", policy ) ) {
+                for( int i = 0; i < 6; ++i ) {
+                    if( j13.load( 0, stamps[i] ) && j13.get_toc()["f"].stamp == stamps[i] && j13.read( "f" ) == std::to_string( stamps[i] ) ) {
+                        found += char( '0' + i );
+                    }
+                }
+                found += j13.load( 0, T ) && j13.read( "g" ) == "g" ? "g" : "";
+            }
+            return found;
+        };
+        journey::retention policy;
+        policy.now = T;
+        test( kept( policy ) == "5g" );
+        policy.versions = 3;
+        test( kept( policy ) == "345g" );
+        policy.versions = 1, policy.daily = 7;
+        test( kept( policy ) == "235g" );
+        policy.weekly = 8;
+        test( kept( policy ) == "01235g" );
+        policy.max_age = 30 * 86400;
+        test( kept( policy ) == "1235g" );
+    }
+
+    suite( "compaction plans, from an index-only scan" ) {
+        auto size = []( const char *file ) { return uint64_t( std::ifstream( file, std::ios::binary | std::ios::ate ).tellg() ); };
+        journey j12( "journey12.joy" );
+        journey::retention policy;
+        policy.now = 1000 * 86400ULL, policy.versions = 3;
+        journey::plan p = j12.plan_compaction( policy );
+        std::remove( "journey13.joy" );
+        test( j12.compact( "journey13.joy", policy ) && p.output == size( "journey13.joy" ) && p.entries == 4 );
+        test( p.input == size( "journey12.joy" ) && p.reclaimable == p.input - p.output && p.seconds > 0 );
+        test( j12.plan_compaction( policy, p.output ).seconds == 1 && j12.plan_compaction().entries == 0 );
+        journey j9( "journey9.joy" );
+        test( j9.load(0, now, debugstream) );
+        j9.seal = true;
+        p = j9.plan_compaction();
+        std::remove( "journey13.joy" );
+        test( j9.compact( "journey13.joy" ) && p.output == size( "journey13.joy" ) && p.entries == 40 && p.ok );
+        // plans tell when the journal cannot be read
+        std::remove( "journey74.joy" );
+        journey j74( "journey74.joy" );
+        std::string chunky( 20000, '\0' );
+        for( size_t i = 0; i < chunky.size(); ++i ) chunky[i] = char( i * 7919 >> 5 );
+        j74.chunking = 1024;
+        test( j74.append( "chunky", chunky.c_str(), chunky.size(), past ) && j74.load(0, now, debugstream) && j74.get_toc()[ "chunky" ].chunked );
+        test( j74.plan_compaction().ok && j74.plan_compaction( policy ).ok );
+        std::string whole;
+        {
+            std::ifstream in( "journey74.joy", std::ios::binary );
+            whole.assign( std::istreambuf_iterator<char>( in ), std::istreambuf_iterator<char>() );
+        }
+        std::ofstream( "journey74.joy", std::ios::binary | std::ios::trunc ).write( whole.data(), whole.size() - 100 );
+        test( !j74.plan_compaction().ok );
+    }
+
+    suite( "k-way merge of several journals" ) {
+        const char *names[] = { "journey14.joy", "journey15.joy", "journey16.joy" };
+        std::remove( "journey17.joy" );
+        for( int i = 0; i < 3; ++i ) {
+            std::remove( names[i] );
+            journey in( names[i] );
+            for( int k = 0; k < 20; ++k ) {
+                std::string data = std::to_string( i * 100 + k );
+                in.append( "n" + std::to_string( k % ( 5 + i * 5 ) ), data.c_str(), data.size(), past + ( i == 1 ? 50 : k ) );
+            }
+        }
+        test( journey::merge( std::vector<std::string>( names, names + 3 ), "journey17.joy", 3 ) );
+        journey j17( "journey17.joy" );
+        std::stringstream listing;
+        test( j17.load(0, now, &listing) && j17.get_toc().size() == 15 );
+        test( j17.read( "n0" ) == "110" && j17.read( "n7" ) == "117" && j17.read( "n12" ) == "212" );
+        test( j17.load(0, past + 49) && j17.get_toc().size() == 5 && j17.read( "n0" ).empty() );
+        test( std::count( std::istreambuf_iterator<char>( listing ), std::istreambuf_iterator<char>(), '\n' ) == 15 + 1 );
+        // inputs that cannot be loaded fail the merge
+        std::remove( "journey16.joy" );
+        test( !journey::merge( std::vector<std::string>( names, names + 3 ), "journey17.joy", 3 ) );
+    }
+
+    suite( "compaction layout, by path and by recorded access trace" ) {
+        const char *names[] = { "b", "a/y", "a.txt", "a/x/1", "c", "a/x" };
+        journey j18( "journey18.joy" );
+        for( auto name : names ) {
+            j18.append( name, name, strlen( name ), past );
+        }
+        auto offsets = [&]( const char *file ) {
+            journey j19( file );
+            std::map<uint64_t, std::string> sorted;
+            j19.load( 0, now );
+            for( auto &it : j19.get_toc() ) {
+                sorted[ it.second.offset ] = it.first;
+            }
+            std::string line;
+            for( auto &it : sorted ) {
+                line += it.second + " ";
+            }
+            return line;
+        };
+        test( j18.load(0, now, debugstream) );
+        j18.order = journey::by_path;
+        test( j18.compact( "journey19.joy" ) && offsets( "journey19.joy" ) == "a/x a/x/1 a/y a.txt b c " );
+        j18.tracing = true;
+        test( j18.read( "c" ) == "c" && j18.read( "a/y" ) == "a/y" && j18.read( "c" ) == "c" );
+        j18.order = journey::by_trace;
+        test( j18.compact( "journey20.joy" ) && offsets( "journey20.joy" ) == "c a/y b a.txt a/x/1 a/x " );
+    }
+
+    suite( "sealed journals, read through their footer index" ) {
+        journey j21( "journey9.joy" );
+        test( j21.load(0, now, debugstream) );
+        j21.seal = true;
+        std::remove( "journey21.joy" );
+        test( j21.compact( "journey21.joy" ) );
+        journey j22( "journey21.joy" );
+        test( j22.load_index() && j22.get_toc().empty() );
+        bool same = true;
+        for( auto &it : j21.get_toc() ) {
+            same = same && j22.read( it.first ) == j21.read( it.first );
+        }
+        test( same && j22.read( "item40" ).empty() && j22.read( "" ).empty() );
+        test( j22.load(0, now, debugstream) && j22.get_toc().size() == 40 && j22.read( "item39" ) == j21.read( "item39" ) );
+        test( !journey( "journey9.joy" ).load_index() );
+        // entries read through the index are checked against their crc too
+        std::remove( "journey75.joy" );
+        std::remove( "journey76.joy" );
+        journey j75( "journey75.joy" );
+        j75.checksum = j75.seal = true;
+        test( j75.append( "a", "alpha", 5, past ) && j75.append( "b", "bravo", 5, past ) && j75.load(0, now, debugstream) && j75.compact( "journey76.joy" ) );
+        journey j76( "journey76.joy" );
+        j76.verify = journey::verify_always;
+        test( j76.load_index() && j76.read( "b" ) == "bravo" );
+        uint64_t at = 0;
+        {
+            std::ifstream in( "journey76.joy", std::ios::binary );
+            std::string whole( ( std::istreambuf_iterator<char>( in ) ), std::istreambuf_iterator<char>() );
+            at = whole.find( "bravo" );
+        }
+        {
+            std::fstream f( "journey76.joy", std::ios::in | std::ios::out | std::ios::binary );
+            f.seekp( at ).put( 'B' );
+        }
+        test( j76.load_index() && j76.read( "b" ).empty() && j76.read( "a" ) == "alpha" );
+    }
+
+    suite( "compressed entries" ) {
+        std::remove( "journey24.joy" );
+        journey j24( "journey24.joy" );
+        j24.compress = j24.dedupe = true;
+        std::string json, noise, runs( 100000, 'z' );
+        for( int i = 0; i < 500; ++i ) {
+            json += "{\"id\": " + std::to_string( i ) + ", \"name\": \"item" + std::to_string( i % 7 ) + "\", \"tags\": [\"a\", \"b\"]},\n";
+        }
+        for( uint64_t i = 0, x = 1; i < 20000; ++i ) {
+            noise += char( ( x = x * 6364136223846793005ULL + 1442695040888963407ULL ) >> 56 );
+        }
+        test( j24.append( "json", json.data(), json.size(), now ) && j24.append( "noise", noise.data(), noise.size(), now ) );
+        test( j24.append( "runs", runs.data(), runs.size(), now ) && j24.append( "tiny", "tiny", 4, now ) );
+        test( std::ifstream( "journey24.joy", std::ios::binary | std::ios::ate ).tellg() < int64_t( json.size() / 3 + noise.size() + 2000 ) );
+        test( j24.load(0, now, debugstream) && j24.get_toc()["json"].raw == json.size() && j24.get_toc()["noise"].raw == 0 );
+        test( j24.read( "json" ) == json && j24.read( "noise" ) == noise && j24.read( "runs" ) == runs && j24.read( "tiny" ) == "tiny" );
+        uint64_t size = std::ifstream( "journey24.joy", std::ios::binary | std::ios::ate ).tellg();
+        test( j24.append( "json", json.data(), json.size(), now ) && uint64_t( std::ifstream( "journey24.joy", std::ios::binary | std::ios::ate ).tellg() ) == size );
+        j24.order = journey::by_path;
+        std::remove( "journey25.joy" );
+        test( j24.compact( "journey25.joy" ) );
+        journey j25( "journey25.joy" );
+        test( j25.load(0, now, debugstream) && j25.read( "json" ) == json && j25.read( "runs" ) == runs && j25.read( "noise" ) == noise );
+    }
+
+    suite( "trained dictionaries" ) {
+        std::remove( "journey26.joy" );
+        journey j26( "journey26.joy" );
+        j26.compress = true;
+        auto config = []( int i ) {
+            return "{\"service\": \"frontend-" + std::to_string( i % 13 ) + "\", \"replicas\": " + std::to_string( i % 5 ) +
+                   ", \"region\": \"eu-west-" + std::to_string( i % 3 ) + "\", \"limits\": {\"cpu\": \"500m\", \"memory\": \"256Mi\"}, " +
+                   "\"image\": \"registry.example.com/web/frontend:1." + std::to_string( i % 7 ) + "\", \"probes\": {\"liveness\": \"/healthz\", " +
+                   "\"readiness\": \"/ready\", \"period\": " + std::to_string( 10 + i % 4 ) + "}, \"env\": {\"LOG_LEVEL\": \"info\", " +
+                   "\"FEATURE_FLAGS\": \"checkout,search\"}, \"owner\": \"team-" + std::to_string( i % 9 ) + "\", \"version\": " + std::to_string( i ) + "}";
+        };
+        auto size = []() { return uint64_t( std::ifstream( "journey26.joy", std::ios::binary | std::ios::ate ).tellg() ); };
+        bool appended = true;
+        for( int i = 0; i < 200; ++i ) {
+            appended = appended && j26.append( "cfg" + std::to_string( i ), config( i ).data(), config( i ).size(), now );
+        }
+        uint64_t plain = size();
+        test( appended && j26.load(0, now, debugstream) && j26.get_toc()["cfg0"].raw == 0 && j26.train() );
+        uint64_t trained = size();
+        for( int i = 200; i < 400; ++i ) {
+            appended = appended && j26.append( "cfg" + std::to_string( i ), config( i ).data(), config( i ).size(), now );
+        }
+        test( appended && ( size() - trained ) * 2 < plain );
+        test( trained - plain < 16384 + 200 );
+        journey j27( "journey26.joy" );
+        test( j27.load(0, now, debugstream) && j27.get_toc()["cfg300"].raw && j27.get_toc()["cfg300"].dict );
+        bool same = true;
+        for( int i = 0; i < 400; ++i ) {
+            same = same && j27.read( "cfg" + std::to_string( i ) ) == config( i );
+        }
+        test( same );
+        std::remove( "journey27.joy" );
+        std::remove( "journey28.joy" );
+        std::remove( "journey29.joy" );
+        test( j27.compact( "journey27.joy" ) );
+        j27.retrain = true;
+        test( j27.compact( "journey28.joy" ) );
+        test( std::ifstream( "journey28.joy", std::ios::binary | std::ios::ate ).tellg() < std::ifstream( "journey27.joy", std::ios::binary | std::ios::ate ).tellg() );
+        j27.seal = true;
+        test( j27.compact( "journey29.joy" ) );
+        journey j28( "journey27.joy" ), j29( "journey29.joy" );
+        test( j28.load(0, now, debugstream) && j29.load_index() );
+        for( int i = 0; i < 400; ++i ) {
+            same = same && j28.read( "cfg" + std::to_string( i ) ) == config( i ) && j29.read( "cfg" + std::to_string( i ) ) == config( i );
+        }
+        test( same && j29.load(0, now, debugstream) && j29.get_toc()["cfg0"].dict && j29.read( "cfg0" ) == config( 0 ) );
+    }
+
+    suite( "content-defined chunking" ) {
+        std::remove( "journey30.joy" );
+        journey j30( "journey30.joy" );
+        j30.chunking = 4096;
+        std::string image;
+        for( uint64_t i = 0, x = 7; i < ( 1 << 20 ); ++i ) {
+            image += char( ( x = x * 6364136223846793005ULL + 1442695040888963407ULL ) >> 59 );
+        }
+        std::vector<std::string> versions;
+        bool appended = true;
+        for( int v = 0; v < 8; ++v ) {
+            image[ ( v * 130000 + 4321 ) % image.size() ] ^= 1;
+            image.insert( ( v * 70001 ) % image.size(), std::string( 100, char( 'a' + v ) ) );
+            versions.push_back( image );
+            appended = appended && j30.append( "disk.img", image.data(), image.size(), past + v );
+        }
+        test( appended && std::ifstream( "journey30.joy", std::ios::binary | std::ios::ate ).tellg() < int64_t( 2 * image.size() ) );
+        test( j30.load(0, now, debugstream) && j30.get_toc()["disk.img"].chunked == image.size() && j30.read( "disk.img" ) == image );
+        test( j30.load(0, past + 3, debugstream) && j30.read( "disk.img" ) == versions[3] );
+        test( j30.load(0, now, debugstream) && j30.append( "small", "small", 5 ) );
+        std::remove( "journey31.joy" );
+        test( j30.compact( "journey31.joy" ) );
+        test( std::ifstream( "journey31.joy", std::ios::binary | std::ios::ate ).tellg() < int64_t( image.size() + image.size() / 2 ) );
+        journey j31( "journey31.joy" );
+        test( j31.load(0, now, debugstream) && j31.read( "disk.img" ) == image && j31.get_toc().size() == 1 );
+        j30.seal = true;
+        std::remove( "journey32.joy" );
+        test( j30.compact( "journey32.joy" ) );
+        journey j32( "journey32.joy" );
+        test( j32.load_index() && j32.read( "disk.img" ) == image );
+    }
+
+    suite( "binary deltas" ) {
+        std::remove( "journey33.joy" );
+        journey j33( "journey33.joy" );
+        j33.delta_chain = 3;
+        std::string log;
+        for( uint64_t i = 0, x = 3; i < 100000; ++i ) {
+            log += char( 'a' + ( ( x = x * 6364136223846793005ULL + 1442695040888963407ULL ) >> 59 ) );
+        }
+        std::vector<std::string> versions;
+        bool appended = true;
+        unsigned deltas = 0, longest = 0, chain = 0;
+        for( int v = 0; v < 8; ++v ) {
+            log.replace( v * 9000, 10, "edited " + std::to_string( v ) );
+            log += "line " + std::to_string( v ) + "\n";
+            versions.push_back( log );
+            appended = appended && j33.append( "app.log", log.data(), log.size(), past + v );
+            appended = appended && j33.load(0, now, debugstream);
+            chain = j33.get_toc()["app.log"].delta ? chain + 1 : 0;
+            deltas += chain > 0, longest = chain > longest ? chain : longest;
+        }
+        test( appended && deltas == 6 && longest == 3 );
+        test( std::ifstream( "journey33.joy", std::ios::binary | std::ios::ate ).tellg() < int64_t( 3 * log.size() ) );
+        test( j33.get_toc()["app.log"].patched == log.size() && j33.read( "app.log" ) == log );
+        test( j33.load(0, past + 2, debugstream) && j33.read( "app.log" ) == versions[2] );
+        test( j33.load(0, past + 6, debugstream) && j33.read( "app.log" ) == versions[6] );
+        test( j33.load(0, now, debugstream) );
+        journey::retention keep;
+        keep.versions = 3;
+        std::remove( "journey34.joy" );
+        test( j33.compact( "journey34.joy", keep ) );
+        journey j34( "journey34.joy" );
+        test( j34.load(0, now, debugstream) && !j34.get_toc()["app.log"].delta && j34.read( "app.log" ) == log );
+        test( j34.load(0, past + 5, debugstream) && !j34.get_toc()["app.log"].delta && j34.read( "app.log" ) == versions[5] );
+        j34.delta_chain = 1;
+        j34.compress = true;
+        test( j34.load(0, now, debugstream) && j34.append( "app.log", versions[0].data(), versions[0].size(), now ) );
+        test( j34.load(0, now, debugstream) && j34.get_toc()["app.log"].delta && j34.read( "app.log" ) == versions[0] );
+    }
+
+    suite( "checksums, verified on read" ) {
+        test( journey::crc32c( "123456789", 9 ) == 0xE3069283 );
+        test( journey::crc32c( std::string( 32, '\0' ).data(), 32 ) == 0x8A9136AA );
+        std::remove( "journey35.joy" );
+        journey j35( "journey35.joy" );
+        j35.checksum = true;
+        std::string text( 3000, 'x' );
+        test( j35.append( "text", text.data(), text.size(), now ) && j35.append( "word", "word", 4, now ) );
+        test( j35.load(0, now, debugstream) && j35.get_toc()["text"].crc && j35.get_toc()["word"].crc );
+        j35.verify = journey::verify_first;
+        test( j35.read( "text" ) == text );
+        {
+            std::fstream f( "journey35.joy", std::ios::in | std::ios::out | std::ios::binary );
+            f.seekp( j35.get_toc()["text"].offset + 100 ).put( 'y' );
+        }
+        test( j35.read( "text" ).size() == text.size() && j35.read( "text" ) != text );
+        j35.verify = journey::verify_always;
+        test( j35.read( "text" ).empty() && j35.read( "word" ) == "word" );
+        j35.verify = journey::verify_first;
+        test( j35.load(0, now, debugstream) && j35.read( "text" ).empty() );
+        j35.verify = journey::verify_never;
+        test( j35.read( "text" ).size() == text.size() );
+        // reads may run concurrently, even while they record what they verified
+        j35.verify = journey::verify_first;
+        std::vector<std::thread> readers;
+        std::vector<int> words( 4, 0 );
+        for( int t = 0; t < 4; ++t ) {
+            readers.push_back( std::thread( [&, t] {
+                for( int i = 0; i < 100; ++i ) words[t] += j35.read( "word" ) == "word";
+            } ) );
+        }
+        for( auto &reader : readers ) reader.join();
+        test( words == std::vector<int>( 4, 100 ) );
+    }
+
+    suite( "foreign-endian journals" ) {
+        std::remove( "journey36.joy" );
+        journey j36( "journey36.joy" );
+        j36.dedupe = j36.compress = true;
+        std::string text( 2000, 'z' );
+        test( j36.append( "text", text.data(), text.size(), past ) && j36.append( "word", "word", 4, past ) );
+        // byte-swap every info block, as a host of the other endianness would have written them
+        {
+            std::fstream f( "journey36.joy", std::ios::in | std::ios::out | std::ios::binary | std::ios::ate );
+            for( uint64_t pos = uint64_t( f.tellg() ), block[5]; pos >= 8*5; pos -= 8*5 + block[3] ) {
+                f.seekg( pos - 8*5 ).read( (char *)block, sizeof(block) );
+                uint64_t swapped[5];
+                for( int i = 0; i < 5; ++i ) {
+                    swapped[i] = 0;
+                    for( int b = 0; b < 8; ++b ) swapped[i] |= ( block[i] >> ( b * 8 ) & 0xff ) << ( 56 - b * 8 );
+                }
+                f.seekp( pos - 8*5 ).write( (const char *)swapped, sizeof(swapped) );
+            }
+        }
+        test( j36.load(0, now, debugstream) && j36.get_toc().size() == 2 && j36.get_toc()["text"].raw == text.size() );
+        test( j36.read( "text" ) == text && j36.read( "word" ) == "word" && j36.get_toc()["word"].stamp == past );
+        test( j36.append( "word", "word", 4, now ) && j36.append( "more", "more", 4, now ) );
+        test( j36.load(0, now, debugstream) && j36.get_toc().size() == 3 && j36.read( "more" ) == "more" && j36.read( "text" ) == text );
+        std::remove( "journey37.joy" );
+        test( j36.compact( "journey37.joy" ) );
+        journey j37( "journey37.joy" );
+        test( j37.load(0, now, debugstream) && j37.get_toc().size() == 3 && j37.read( "text" ) == text && j37.read( "word" ) == "word" );
+    }
+
+    suite( "format 3 entries (varint trailers)" ) {
+        std::remove( "journey38.joy" );
+        std::remove( "journey39.joy" );
+        journey j38( "journey38.joy" ), j39( "journey39.joy" );
+        j39.format = 3;
+        bool appended = true;
+        for( int i = 0; i < 1000; ++i ) {
+            std::string name = "metric" + std::to_string( i ), data = "{\"v\":" + std::to_string( i * 7 ) + "}";
+            appended = appended && j38.append( name, data.data(), data.size(), past ) && j39.append( name, data.data(), data.size(), past );
+        }
+        test( appended );
+        int64_t v2 = std::ifstream( "journey38.joy", std::ios::binary | std::ios::ate ).tellg();
+        int64_t v3 = std::ifstream( "journey39.joy", std::ios::binary | std::ios::ate ).tellg();
+        test( v3 * 2 < v2 );
+        // both formats in one journal, with tags in either
+        j39.checksum = j39.dedupe = true;
+        j39.format = 2;
+        test( j39.append( "wide", "wide", 4, past + 1 ) );
+        j39.format = 3;
+        test( j39.append( "metric7", "updated", 7, past + 2 ) && j39.append( "wide", "narrow", 6, past + 3 ) );
+        test( j39.load(0, now, debugstream) && j39.get_toc().size() == 1001 && j39.get_toc()["metric7"].crc && j39.get_toc()["wide"].hash );
+        j39.verify = journey::verify_always;
+        test( j39.read( "metric7" ) == "updated" && j39.read( "metric999" ) == "{\"v\":6993}" && j39.read( "wide" ) == "narrow" );
+        test( j39.load(0, past + 1, debugstream) && j39.read( "wide" ) == "wide" && j39.read( "metric7" ) == "{\"v\":49}" );
+        // compaction converts between formats
+        std::remove( "journey40.joy" );
+        j38.format = 3;
+        test( j38.load(0, now, debugstream) && j38.compact( "journey40.joy" ) );
+        test( std::ifstream( "journey40.joy", std::ios::binary | std::ios::ate ).tellg() == v3 );
+        journey j40( "journey40.joy" );
+        test( j40.load(0, now, debugstream) && j40.get_toc().size() == 1000 && j40.read( "metric500" ) == "{\"v\":3500}" );
+        std::remove( "journey41.joy" );
+        test( j39.load(0, now, debugstream) && j39.compact( "journey41.joy" ) );
+        journey j41( "journey41.joy" );
+        test( j41.load(0, now, debugstream) && j41.get_toc().size() == 1001 && j41.read( "wide" ) == "narrow" );
+        // binary deltas against format 3 versions
+        std::string log( 20000, '-' );
+        j41.delta_chain = 2;
+        test( j41.append( "log", log.data(), log.size(), now ) && j41.load(0, now, debugstream) );
+        log += "more";
+        test( j41.append( "log", log.data(), log.size(), now ) && j41.load(0, now, debugstream) );
+        test( j41.get_toc()["log"].delta && j41.read( "log" ) == log );
+    }
+
+    suite( "packs of small files" ) {
+        std::remove( "journey42.joy" );
+        journey j42( "journey42.joy" );
+        std::vector< std::pair<std::string, std::string> > files, more;
+        for( int i = 0; i < 1000; ++i ) {
+            files.push_back( std::make_pair( "dir/file" + std::to_string( i ), std::string( i % 50, char( 'a' + i % 26 ) ) ) );
+        }
+        more.push_back( std::make_pair( "dir/file1", std::string( "newer" ) ) );
+        more.push_back( std::make_pair( "other", std::string( "other" ) ) );
+        test( j42.append_pack( files, past ) && j42.append( "loose", "loose", 5, past ) && j42.append_pack( more, past + 1 ) );
+        test( !j42.append_pack( std::vector< std::pair<std::string, std::string> >() ) );
+        test( j42.load(0, now, debugstream) && j42.get_toc().size() == 1000 + 2 && j42.get_toc()["dir/file2"].packed );
+        test( j42.read( "dir/file2" ) == "cc" && j42.read( "dir/file999" ) == files[999].second && j42.read( "dir/file0" ).empty() );
+        test( j42.read( "dir/file1" ) == "newer" && j42.read( "other" ) == "other" && j42.read( "loose" ) == "loose" );
+        test( j42.load(0, past, debugstream) && j42.read( "dir/file1" ) == "b" && !j42.get_toc().count( "other" ) );
+        test( j42.load(0, now, debugstream) && j42.append( "dir/file3", "loose", 5, now ) );
+        // compaction re-packs the live records only
+        std::remove( "journey43.joy" );
+        test( j42.load(0, now, debugstream) && j42.compact( "journey43.joy" ) );
+        journey j43( "journey43.joy" );
+        test( j43.load(0, now, debugstream) && j43.get_toc().size() == 1002 && j43.get_toc()["dir/file4"].packed );
+        test( j43.read( "dir/file1" ) == "newer" && j43.read( "dir/file3" ) == "loose" && j43.read( "dir/file49" ) == files[49].second );
+        test( std::ifstream( "journey43.joy", std::ios::binary | std::ios::ate ).tellg() < std::ifstream( "journey42.joy", std::ios::binary | std::ios::ate ).tellg() );
+        j42.seal = true;
+        j42.order = journey::by_path;
+        std::remove( "journey44.joy" );
+        test( j42.compact( "journey44.joy" ) );
+        journey j44( "journey44.joy" );
+        test( j44.load_index() && j44.read( "dir/file998" ) == files[998].second && j44.read( "dir/file1" ) == "newer" );
+        test( j44.load(0, now, debugstream) && j44.get_toc().size() == 1002 && j44.read( "dir/file500" ) == files[500].second );
+    }
+
+    suite( "tombstones" ) {
+        std::remove( "journey45.joy" );
+        journey j45( "journey45.joy" );
+        j45.dedupe = true;
+        bool appended = true;
+        for( int i = 0; i < 10; ++i ) {
+            appended = appended && j45.append( "tmp/" + std::to_string( i ), "temp", 4, past );
+        }
+        test( appended && j45.append( "kept", "kept", 4, past ) && j45.append( "gone", "v1", 2, past ) && j45.append( "gone", "v2", 2, past + 1 ) );
+        test( j45.load(0, now, debugstream) && j45.get_toc().size() == 12 );
+        test( j45.erase( "gone", past + 2 ) && !j45.get_toc().count( "gone" ) && j45.read( "gone" ).empty() );
+        test( j45.erase_prefix( "tmp/", past + 2 ) && j45.get_toc().size() == 1 );
+        test( !j45.erase( "" ) && !j45.erase_prefix( std::string( 1, '\0' ) ) );
+        test( j45.load(0, now, debugstream) && j45.get_toc().size() == 1 && j45.read( "kept" ) == "kept" );
+        // tombstones outside the stamp range are not honored
+        test( j45.load(0, past + 1, debugstream) && j45.get_toc().size() == 12 && j45.read( "gone" ) == "v2" );
+        // re-appending after a deletion revives a name, dedupe or not
+        test( j45.load(0, now, debugstream) && j45.append( "gone", "v2", 2, past + 3 ) && j45.append( "tmp/3", "back", 4, past + 3 ) );
+        test( j45.load(0, now, debugstream) && j45.get_toc().size() == 3 && j45.read( "gone" ) == "v2" && j45.read( "tmp/3" ) == "back" );
+        // compactions drop deleted names, and tombstones themselves
+        std::remove( "journey46.joy" );
+        test( j45.compact( "journey46.joy" ) );
+        journey j46( "journey46.joy" );
+        test( j46.load(0, now, debugstream) && j46.get_toc().size() == 3 && j46.read( "tmp/3" ) == "back" );
+        journey::retention all;
+        all.versions = 10;
+        std::remove( "journey47.joy" );
+        test( j45.compact( "journey47.joy", all ) );
+        test( std::ifstream( "journey47.joy", std::ios::binary | std::ios::ate ).tellg() == std::ifstream( "journey46.joy", std::ios::binary | std::ios::ate ).tellg() );
+        journey j47( "journey47.joy" );
+        test( j47.load(0, now, debugstream) && j47.get_toc().size() == 3 && j47.load(0, past + 2, debugstream) && j47.get_toc().size() == 1 );
+        // merges let newer tombstones of one input delete names of another
+        std::remove( "journey48.joy" );
+        std::remove( "journey49.joy" );
+        journey j48( "journey48.joy" );
+        test( j48.append( "kept", "newer", 5, past + 4 ) && j48.append( "x", "x", 1, past + 4 ) && j48.load(0, now, debugstream) );
+        test( j48.erase( "tmp/3", past + 4 ) && j48.erase_prefix( "k", past + 5 ) );
+        test( journey::merge( { "journey46.joy", "journey48.joy" }, "journey49.joy" ) );
+        journey j49( "journey49.joy" );
+        test( j49.load(0, now, debugstream) && j49.get_toc().size() == 2 && j49.read( "gone" ) == "v2" && j49.read( "x" ) == "x" );
+    }
+
+    suite( "links, sharing data across names" ) {
+        std::remove( "journey50.joy" );
+        journey j50( "journey50.joy" );
+        std::string big( 100000, 'b' ), v1 = big, v2 = big;
+        v1[ 500 ] = '1', v2[ 500 ] = '2';
+        j50.delta_chain = 4;
+        test( j50.append( "big", big.c_str(), big.size(), past ) && j50.append_pack( { { "p/a", "aaa" }, { "p/b", "bbb" } }, past ) );
+        test( j50.append( "edit", v1.c_str(), v1.size(), past ) && j50.load(0, now, debugstream) && j50.append( "edit", v2.c_str(), v2.size(), past ) );
+        test( j50.load(0, now, debugstream) && !j50.link( "x", "missing" ) && !j50.link( "", "big" ) );
+        uint64_t before = std::ifstream( "journey50.joy", std::ios::binary | std::ios::ate ).tellg();
+        test( j50.link( "moved", "big", past + 1 ) && j50.link( "p/c", "p/b", past + 1 ) && j50.link( "edited", "edit", past + 1 ) );
+        test( j50.erase( "big", past + 1 ) && j50.load(0, now, debugstream) && j50.link( "again", "moved", past + 2 ) );
+        test( uint64_t( std::ifstream( "journey50.joy", std::ios::binary | std::ios::ate ).tellg() ) - before < 1000 );
+        test( j50.load(0, now, debugstream) && !j50.get_toc().count( "big" ) && j50.read( "moved" ) == big && j50.read( "again" ) == big );
+        test( j50.read( "p/c" ) == "bbb" && j50.read( "edited" ) == v2 && j50.get_toc()[ "again" ].offset == j50.get_toc()[ "moved" ].offset );
+        // compactions keep sharing data between the names that survive, and copy it for the rest
+        std::remove( "journey51.joy" );
+        test( j50.compact( "journey51.joy" ) );
+        test( std::ifstream( "journey51.joy", std::ios::binary | std::ios::ate ).tellg() < 2 * 100000 + 1000 );
+        journey j51( "journey51.joy" );
+        test( j51.load(0, now, debugstream) && j51.get_toc().size() == 7 && j51.read( "moved" ) == big && j51.read( "again" ) == big );
+        test( j51.read( "p/c" ) == "bbb" && j51.read( "edited" ) == v2 && j51.read( "edit" ) == v2 );
+        test( j51.get_toc()[ "again" ].offset == j51.get_toc()[ "moved" ].offset && j51.get_toc()[ "edited" ].offset == j51.get_toc()[ "edit" ].offset );
+        std::remove( "journey52.joy" );
+        test( j51.erase( "moved", past + 3 ) && j51.erase( "edit", past + 3 ) && j51.load(0, now, debugstream) && j51.compact( "journey52.joy" ) );
+        journey j52( "journey52.joy" );
+        test( j52.load(0, now, debugstream) && j52.get_toc().size() == 5 && j52.read( "again" ) == big && j52.read( "edited" ) == v2 );
+        std::remove( "journey54.joy" );
+        test( j50.compact( "journey54.joy", journey::retention() ) );
+        journey j54( "journey54.joy" );
+        test( j54.load(0, now, debugstream) && j54.get_toc().size() == 7 && j54.read( "again" ) == big && j54.read( "p/c" ) == "bbb" );
+        // dedupe links content already stored under another name
+        std::remove( "journey53.joy" );
+        journey j53( "journey53.joy" );
+        j53.dedupe = true;
+        j53.format = 3;
+        test( j53.append( "a", big.c_str(), big.size(), past ) && j53.load(0, now, debugstream) && j53.append( "b", big.c_str(), big.size(), past ) );
+        test( std::ifstream( "journey53.joy", std::ios::binary | std::ios::ate ).tellg() < 100000 + 100 );
+        test( j53.load(0, now, debugstream) && j53.read( "b" ) == big && j53.get_toc()[ "b" ].offset == j53.get_toc()[ "a" ].offset );
+    }
+
+    suite( "per-entry alignment, kept or raised by compaction" ) {
+        std::remove( "journey55.joy" );
+        journey j55( "journey55.joy" );
+        std::string blob( 3000, 'w' );
+        bool appended = true;
+        for( uint64_t a : { 8, 64, 4096, 2 << 20, 8, 4096 } ) {
+            j55.align = a;
+            appended = appended && j55.append( "w" + std::to_string( a ), blob.c_str(), blob.size(), past );
+        }
+        j55.align = 8;
+        test( appended && j55.append( "unaligned", "u", 1, past ) );
+        j55.align = 12;
+        test( !j55.append( "bad", "b", 1, past ) );
+        j55.align = 4 << 20;
+        test( !j55.append( "bad", "b", 1, past ) );
+        j55.align = 8;
+        test( j55.load(0, now, debugstream) && j55.get_toc().size() == 5 );
+        auto aligned = []( const journey &j ) {
+            bool ok = true;
+            for( auto &it : j.get_toc() ) {
+                uint64_t want = it.first == "unaligned" ? 8 : std::stoull( it.first.substr( 1 ) );
+                // (format 3 entries are unaligned)
+                ok = ok && ( want == 8 || it.second.offset % want == 0 ) && j.read( it.first ).size() == ( it.first == "unaligned" ? 1 : 3000 );
+                ok = ok && it.second.align == ( want > 8 ? want : 0 );
+            }
+            return ok;
+        };
+        test( aligned( j55 ) && j55.get_toc()[ "w2097152" ].align == 2 << 20 );
+        // compactions keep the alignment of every entry, in either format
+        for( int format : { 2, 3 } ) {
+            std::remove( "journey56.joy" );
+            j55.format = format;
+            test( j55.compact( "journey56.joy" ) );
+            journey j56( "journey56.joy" );
+            test( j56.load(0, now, debugstream) && aligned( j56 ) );
+        }
+        // or re-align the journal, raising the alignment of the entries below theirs
+        std::remove( "journey57.joy" );
+        j55.align = 4096;
+        test( j55.compact( "journey57.joy" ) );
+        journey j57( "journey57.joy" );
+        test( j57.load(0, now, debugstream) && j57.get_toc().size() == 5 );
+        for( auto &it : j57.get_toc() ) {
+            test( it.second.offset % 4096 == 0 && it.second.align >= 4096 );
+        }
+        j55.align = 3;
+        test( !j55.compact( "journey58.joy" ) );
+    }
+
+    suite( "encrypted entries" ) {
+        // rfc 8439, 2.8.2
+        std::string key( 32, '\0' ), aad = "\x50\x51\x52\x53\xc0\xc1\xc2\xc3\xc4\xc5\xc6\xc7";
+        std::string text = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.", data = text;
+        for( int i = 0; i < 32; ++i ) key[i] = char( 0x80 + i );
+        char tag[16];
+        test( journey::chacha20_poly1305( key, 7, 0x4746454443424140ULL, &data[0], data.size(), tag, true, aad ) );
+        test( !memcmp( data.data(), "\xd3\x1a\x8d\x34\x64\x8e\x60\xdb\x7b\x86\xaf\xbc\x53\xef\x7e\xc2", 16 ) );
+        test( !memcmp( tag, "\x1a\xe1\x0b\x59\x4f\x09\xe2\x6a\x7e\x90\x2e\xcb\xd0\x60\x06\x91", 16 ) );
+        tag[15] ^= 1;
+        test( !journey::chacha20_poly1305( key, 7, 0x4746454443424140ULL, &data[0], data.size(), tag, false, aad ) && data != text );
+        tag[15] ^= 1;
+        test( journey::chacha20_poly1305( key, 7, 0x4746454443424140ULL, &data[0], data.size(), tag, false, aad ) && data == text );
+        test( !journey::chacha20_poly1305( key.substr( 1 ), 7, 0, &data[0], data.size(), tag, true ) );
+        // draft-irtf-cfrg-xchacha, 2.2.1
+        std::string counting( 32, '\0' );
+        for( int i = 0; i < 32; ++i ) counting[i] = char( i );
+        const uint64_t salt[2] = { 0x4a00000009000000ULL, 0x2759413100000000ULL };
+        test( journey::hchacha20( counting, salt ) == std::string( "\x82\x41\x3b\x42\x27\xb2\x7b\xfe\xd3\x0e\x42\x50\x8a\x87\x7d\x73"
+                                                                 "\xa0\xf9\xe4\xd5\x8a\x74\xa8\x53\xc1\x2e\xc4\x13\x26\xd3\xec\xdc", 32 ) );
+        // neither contents nor names are found in the journal, and read() needs the right key
+        std::remove( "journey59.joy" );
+        journey j59( "journey59.joy" );
+        std::string big( 100000, 'e' ), secret = "top secret";
+        j59.key = key, j59.encrypt_names = true, j59.compress = true, j59.delta_chain = 4;
+        test( j59.append( "secret.txt", secret.c_str(), secret.size(), past ) && j59.append( "big", big.c_str(), big.size(), past ) );
+        big[ 500 ] = '!';
+        test( j59.load(0, now, debugstream) && j59.append( "big", big.c_str(), big.size(), past + 1 ) && j59.load(0, now, debugstream) );
+        test( j59.get_toc().size() == 2 && j59.get_toc()[ "big" ].delta && j59.get_toc()[ "big" ].sealed & 1 );
+        // every entry gets 192 random bits of nonce
+        journey::entry big_e = j59.get_toc()[ "big" ], secret_e = j59.get_toc()[ "secret.txt" ];
+        test( ( big_e.salt[0] || big_e.salt[1] ) && ( big_e.salt[0] != secret_e.salt[0] || big_e.salt[1] != secret_e.salt[1] ) && big_e.sealed != secret_e.sealed );
+        test( j59.read( "secret.txt" ) == secret && j59.read( "big" ) == big );
+        auto contents = []( const char *file ) {
+            std::ifstream in( file, std::ios::binary );
+            return std::string( std::istreambuf_iterator<char>( in ), std::istreambuf_iterator<char>() );
+        };
+        test( contents( "journey59.joy" ).find( "secret" ) == std::string::npos && contents( "journey59.joy" ).find( "eeeeeeee" ) == std::string::npos );
+        journey other( "journey59.joy" );
+        test( other.load(0, now, debugstream) && other.get_toc().size() == 3 && !other.get_toc().count( "big" ) );
+        bool unreadable = true;
+        for( auto &it : other.get_toc() ) unreadable = unreadable && other.read( it.first ).empty();
+        other.key = key, other.key[0] ^= 1;
+        test( unreadable && other.load(0, now, debugstream) && other.get_toc().size() == 3 && other.read( "big" ).empty() );
+        {
+            std::fstream f( "journey59.joy", std::ios::in | std::ios::out | std::ios::binary );
+            f.seekp( j59.get_toc()[ "secret.txt" ].offset + 1 ).put( 'x' );
+        }
+        test( j59.read( "secret.txt" ).empty() && j59.read( "big" ) == big );
+        // compactions rebase and retrain, encrypting what they re-encode anew
+        std::remove( "journey60.joy" );
+        j59.retrain = true;
+        test( j59.compact( "journey60.joy" ) );
+        journey j60( "journey60.joy" );
+        j60.key = key;
+        test( j60.load(0, now, debugstream) && j60.get_toc().size() == 2 && j60.read( "big" ) == big && !j60.get_toc()[ "big" ].delta );
+        test( contents( "journey60.joy" ).find( "big" ) == std::string::npos && contents( "journey60.joy" ).find( "eeeeeeee" ) == std::string::npos );
+        // and move encrypted entries as they are, even without the key. packs and links are written as copies
+        std::remove( "journey61.joy" );
+        std::remove( "journey62.joy" );
+        journey j61( "journey61.joy" );
+        j61.key = key, j61.encrypt_names = true, j61.dedupe = true, j61.format = 3;
+        test( j61.append( "a", "alpha", 5, past ) && j61.append_pack( { { "b", "beta" }, { "c", "gamma" } }, past ) && j61.load(0, now, debugstream) );
+        uint64_t size = contents( "journey61.joy" ).size();
+        test( j61.append( "a", "alpha", 5, past ) && contents( "journey61.joy" ).size() == size && j61.get_toc()[ "a" ].hash != ( journey::hash64( "alpha", 5 ) | 1 ) );
+        test( j61.link( "d", "a", past ) && j61.load(0, now, debugstream) && !j61.get_toc()[ "d" ].link && j61.read( "d" ) == "alpha" );
+        journey keyless( "journey61.joy" );
+        test( keyless.load(0, now, debugstream) && keyless.get_toc().size() == 4 && keyless.compact( "journey62.joy" ) );
+        journey j62( "journey62.joy" );
+        j62.key = key;
+        test( j62.load(0, now, debugstream) && j62.read( "a" ) == "alpha" && j62.read( "b" ) == "beta" && j62.read( "c" ) == "gamma" && j62.read( "d" ) == "alpha" );
+        // data blocks are bound to the name and stamp of their entry
+        std::remove( "journey65.joy" );
+        journey j65( "journey65.joy" );
+        j65.key = key;
+        test( j65.append( "salary/aaa", "100", 3, past ) && j65.append( "salary/bbb", "999999", 6, past + 1 ) );
+        std::string stored = contents( "journey65.joy" );
+        {
+            std::fstream f( "journey65.joy", std::ios::in | std::ios::out | std::ios::binary );
+            f.seekp( stored.rfind( "salary/bbb" ) ).write( "salary/aaa", 10 );
+        }
+        test( j65.load(0, now, debugstream) && j65.get_toc().size() == 1 && j65.read( "salary/aaa" ).empty() );
+        // sealing a journal of encrypted entries writes no footer index
+        std::remove( "journey66.joy" );
+        j61.seal = true;
+        test( j61.load(0, now, debugstream) && j61.compact( "journey66.joy" ) );
+        journey j66( "journey66.joy" );
+        j66.key = key;
+        test( !j66.load_index() && j66.read( "a" ).empty() && j66.load(0, now, debugstream) && j66.read( "a" ) == "alpha" );
+    }
+
+    suite( "torn tails, resynchronized by load()" ) {
+        std::remove( "journey63.joy" );
+        std::remove( "journey64.joy" );
+        journey j63( "journey63.joy" ), j64( "journey64.joy" );
+        std::string blob( 5000, 't' );
+        bool appended = true;
+        for( int i = 0; i < 12; ++i ) {
+            j63.format = 2 + i % 2;
+            j63.checksum = i % 3 == 0;
+            appended = appended && j63.append( "file" + std::to_string( i ), blob.c_str(), 100 + i * 300, past );
+        }
+        test( appended && j64.append( "torn", blob.c_str(), blob.size(), past ) && j63.load(0, now, debugstream) && j63.torn() == 0 );
+        auto size_of = []( const char *file ) {
+            return uint64_t( std::ifstream( file, std::ios::binary | std::ios::ate ).tellg() );
+        };
+        auto contents = []( const char *file ) {
+            std::ifstream in( file, std::ios::binary );
+            return std::string( std::istreambuf_iterator<char>( in ), std::istreambuf_iterator<char>() );
+        };
+        uint64_t size = size_of( "journey63.joy" ), cut = size_of( "journey64.joy" ) - 3;
+        auto tear = [&]( const std::string &bytes ) {
+            std::ofstream( "journey63.joy", std::ios::binary | std::ios::app ).write( bytes.data(), bytes.size() );
+        };
+        std::ifstream in( "journey64.joy", std::ios::binary );
+        std::string torn( cut, '\0' );
+        in.read( &torn[0], cut );
+        // an info block cut short, and a tail of zeros (ie, preallocated)
+        tear( torn );
+        test( j63.load(0, now, debugstream) && j63.get_toc().size() == 12 && j63.torn() == cut && !j63.get_toc().count( "torn" ) );
+        test( j63.read( "file11" ) == blob.substr( 0, 100 + 11 * 300 ) && j63.read( "file0" ) == blob.substr( 0, 100 ) );
+        tear( std::string( 4096, '\0' ) );
+        test( j63.load(0, now, debugstream) && j63.get_toc().size() == 12 && j63.torn() == cut + 4096 );
+        // appends after a torn tail still find the entries before it
+        test( j63.append( "after", "after", 5, past ) && j63.load(0, now, debugstream) && j63.torn() == 0 );
+        test( j63.get_toc().size() == 13 && j63.read( "after" ) == "after" && j63.read( "file3" ) == blob.substr( 0, 100 + 3 * 300 ) );
+#ifdef JOURNEY_POSIX
+        // (a torn tail is only resynchronized on an entry chained to another one)
+        test( j63.append( "more", "more", 4, past ) );
+        tear( torn );
+        test( j63.load(0, now, debugstream) && j63.torn() == cut && j63.repair() && j63.torn() == 0 );
+        auto span = [&]( const char *name ) { return j63.get_toc()[ name ].end - j63.get_toc()[ name ].begin; };
+        test( size_of( "journey63.joy" ) == size + cut + 4096 + span( "after" ) + span( "more" ) );
+        test( j63.load(0, now, debugstream) && j63.torn() == 0 && j63.get_toc().size() == 14 && j63.repair() );
+        std::ofstream( "journey64.joy", std::ios::binary | std::ios::trunc ) << "no entries in here";
+        test( !j64.repair() && size_of( "journey64.joy" ) == 18 );
+#endif
+        // a journal inside the data of a torn append is not resynchronized on
+        std::remove( "journey67.joy" );
+        std::remove( "journey68.joy" );
+        std::remove( "journey69.joy" );
+        journey j67( "journey67.joy" ), j68( "journey68.joy" ), j69( "journey69.joy" );
+        j67.checksum = true;
+        test( j67.append( "hello.txt", "real", 4, past ) && j67.append( "other.txt", "other", 5, past ) );
+        test( j68.append( "hello.txt", "from-inner-payload", 18, past ) );
+        std::string payload = contents( "journey68.joy" ) + std::string( 3000, 'x' );
+        test( j69.append( "payload", payload.c_str(), payload.size(), past ) && j69.load(0, now, debugstream) );
+        std::string carried = contents( "journey69.joy" ).substr( 0, j69.get_toc()[ "payload" ].offset + payload.size() - 1000 );
+        std::ofstream( "journey67.joy", std::ios::binary | std::ios::app ).write( carried.data(), carried.size() );
+        test( j67.load(0, now, debugstream) && j67.torn() == carried.size() && j67.read( "hello.txt" ) == "real" );
+        // nor on an entry whose data no longer matches its crc
+        uint64_t other = j67.get_toc()[ "other.txt" ].offset;
+        {
+            std::fstream f( "journey67.joy", std::ios::in | std::ios::out | std::ios::binary );
+            f.seekp( other ).write( "O", 1 );
+        }
+        test( j67.load(0, now, debugstream) && j67.get_toc().size() == 1 && j67.read( "hello.txt" ) == "real" );
+        test( j67.torn() == size_of( "journey67.joy" ) - j67.get_toc()[ "hello.txt" ].end );
+        // nor on an info block whose lengths do not fit in the file, which is resynchronized past instead
+        std::remove( "journey73.joy" );
+        journey j73( "journey73.joy" );
+        j73.format = 2;
+        test( j73.append( "first", "first", 5, past ) && j73.append( "second", "second", 6, past ) );
+        uint64_t huge = 1ull << 40, end73 = size_of( "journey73.joy" );
+        {
+            std::fstream f( "journey73.joy", std::ios::in | std::ios::out | std::ios::binary );
+            f.seekp( end73 - 8*4 ).write( (const char *)&huge, 8 );
+        }
+        test( j73.load(0, now, debugstream) && j73.get_toc().size() == 1 && j73.read( "first" ) == "first" && j73.torn() > 0 );
+    }
+
+#ifdef JOURNEY_POSIX
+    suite( "online compaction, while appending" ) {
+        std::remove( "journey11.joy" );
+        journey j11( "journey11.joy" );
+        std::string blob( 5000, '.' );
+        bool appended = true;
+        for( int i = 0; i < 400; ++i ) {
+            appended = appended && j11.append( "old" + std::to_string( i % 100 ), blob.c_str(), blob.size(), past );
+        }
+        test( appended );
+        std::thread writer( [&] {
+            journey w( "journey11.joy" );
+            for( int i = 0; i < 300; ++i ) {
+                std::string data = std::to_string( i );
+                appended = appended && w.append( "new" + std::to_string( i % 50 ), data.c_str(), data.size(), now );
+            }
+        } );
+        test( j11.compact_in_place() );
+        writer.join();
+        test( appended );
+        test( j11.load(0, now, debugstream) && j11.get_toc().size() == 150 );
+        test( j11.read( "old99" ) == blob && j11.read( "new0" ) == "250" && j11.read( "new49" ) == "299" );
+        test( std::ifstream( "journey11.joy", std::ios::binary | std::ios::ate ).tellg() < 400 * 5000 );
+        // one compaction at a time: the others fail, leaving the sibling file of the running one alone
+        int busy = ::open( "journey11.joy.compacting", O_RDWR | O_CREAT, 0644 );
+        test( busy >= 0 && 0 == flock( busy, LOCK_EX ) && ::write( busy, "keep", 4 ) == 4 );
+        test( !j11.compact_in_place() && std::ifstream( "journey11.joy.compacting", std::ios::binary | std::ios::ate ).tellg() == 4 );
+        close( busy );
+        test( j11.compact_in_place() && !std::ifstream( "journey11.joy.compacting" ).good() );
+        // the toc loaded before is reloaded, so reads keep finding the moved entries
+        test( j11.get_toc().size() == 150 && j11.read( "new49" ) == "299" && j11.read( "old5" ) == blob );
+        std::remove( "journey11.joy" );
+        for( int i = 0; i < 12; ++i ) {
+            std::string data( 1000, char( 'a' + i ) );
+            j11.append( i < 2 ? "dead" : "f" + std::to_string( i - 2 ), data.c_str(), data.size(), past );
+        }
+        test( j11.load(0, now, debugstream) && j11.compact_in_place() && j11.get_toc().size() == 11 );
+        test( j11.read( "f5" ) == std::string( 1000, 'h' ) && j11.read( "f1" ) == std::string( 1000, 'd' ) );
+    }
+
+    suite( "space amplification, and background compaction" ) {
+        std::remove( "journey23.joy" );
+        journey j23( "journey23.joy" );
+        std::string blob( 1000, '.' );
+        bool appended = true;
+        for( int i = 0; i < 40; ++i ) {
+            appended = appended && j23.append( "item" + std::to_string( i % 10 ), blob.c_str(), blob.size(), past + i );
+        }
+        test( appended && j23.load(0, now, debugstream) );
+        double amp = j23.space_amplification();
+        test( amp > 3.9 && amp < 4.1 );
+        test( j23.append( "item0", "0", 1, now ) && j23.space_amplification() > amp );
+        test( j23.load(0, now, debugstream) && j23.space_amplification() > amp );
+        j23.auto_compact = 2;
+        j23.compaction_rate = 1 << 20;
+        test( j23.append( "item1", "1", 1, now ) );
+        test( j23.load(0, now, debugstream) && j23.space_amplification() < 1.1 && j23.get_toc().size() == 10 );
+        test( j23.read( "item0" ) == "0" && j23.read( "item1" ) == "1" && j23.read( "item9" ) == blob );
+        bool asked = false;
+        j23.compaction_policy = [&]( const journey & ) { return asked = true, false; };
+        test( j23.append( "item2", "2", 1, now ) && asked && j23.load(0, now, debugstream) && j23.read( "item2" ) == "2" );
+        // assigning over a journey with a compaction running discards it, sibling file included
+        j23.compaction_policy = nullptr;
+        j23.auto_compact = 0;
+        for( int i = 0; i < 30; ++i ) {
+            appended = appended && j23.append( "item" + std::to_string( i % 10 ), blob.c_str(), blob.size(), now );
+        }
+        j23.auto_compact = 2;
+        test( appended && j23.load(0, now, debugstream) && j23.append( "item3", "3", 1, now ) );
+        j23 = journey( "journey72.joy" );
+        test( !std::ifstream( "journey23.joy.compacting" ).good() );
+        test( j23.init( "journey23.joy" ) && j23.load(0, now, debugstream) && j23.read( "item3" ) == "3" );
+    }
+#endif
 }
 #endif
 